@@ -134,6 +134,8 @@ inline void DELBM::SetRW(double dc, double dt)
 inline void DELBM::Init(double rho0, Vector3d initV)
 {
 	DomLBM->Init(rho0, initV);
+    // DEM contacts use the same periodic BC (minimum image)
+    for (size_t d=0; d<3; ++d)  DomDEM->Periodic[d] = Periodic[d];
 
     // Mark flag and add particles for the surounding box to handle walls and periodic BC
     // For x axis
@@ -1474,26 +1476,11 @@ inline void DELBM::MoveRW()
                 // for real particles
                 if (ind>5)
                 {
-                    double dis = 1.0e12;
-                    Vector3d xpt;
-                    // if dem is crossing BC then check the shortest distance for every mirror positions
-                    if (demP->crossingFlag)
-                    {
-                        for (size_t i=0; i<demP->Xmir.size(); ++i)
-                        {
-                            double dist = (demP->Xmir[i] - p0->X).norm()-demP->R;
-                            if (dist<dis)
-                            {
-                                xpt = demP->Xmir[i];
-                                dis = dist;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        xpt = demP->X;
-                        dis = (demP->X-p0->X).norm()-demP->R;
-                    }
+                    // use the periodic image of dem which is closest to the rw particle
+                    Vector3d xpt = demP->X-p0->X;
+                    DomDEM->MinimumImage(xpt);
+                    double dis = xpt.norm()-demP->R;
+                    xpt += p0->X;
                     li.push_back(ind);
                     lx.push_back(xpt);
 
@@ -1967,36 +1954,23 @@ inline void DELBM::MoveVAM()
             p0->VelocityVerlet(DomDEM->Dt);
             // if (updatebox)  p0->UpdateBox(D);
         }
-        else
-        {
-            // #pragma omp critical
-            for (size_t d=0; d<3; ++d)
-            {
-                #pragma omp atomic
-                DomDEM->Lg[p0->Group]->Fh(d) += p0->Fh(d);
-                #pragma omp atomic
-                DomDEM->Lg[p0->Group]->Fc(d) += p0->Fc(d);
-            }
-        }            
     }
+    // rigid clumps, see DEM::Move
+    #pragma omp parallel for schedule(dynamic) num_threads(Nproc)
     for (size_t i=0; i<DomDEM->Lg.size(); ++i)
     {
         DEM_PARTICLE* g0 = DomDEM->Lg[i];
+        if (g0->Lo.size()!=g0->Lp.size())   DomDEM->SetClump(g0);
+        DomDEM->ClumpForce(g0);
         CrossPBC(g0);
         g0->VelocityVerlet(DomDEM->Dt);
         // if (updatebox)  g0->UpdateBox(D);
-        // cout << "g0->Fh= " << g0->Fh.transpose() << endl;
-        // cout << "g0->Fc= " << g0->Fc.transpose() << endl;
-        // cout << "g0->M*g0->G= " << g0->M*g0->G.transpose() << endl;
-        // cout << "g0->V= " << g0->V.transpose() << endl;
         g0->ZeroForceTorque(true, true);
-        Vector3d displace = g0->X - g0->Xb;
+        DomDEM->ClumpMembers(g0);
         for (size_t l=0; l<g0->Lp.size(); ++l)
         {
             size_t p = g0->Lp[l];
             DEM_PARTICLE* p0 = DomDEM->Lp[p];
-            p0->X += displace;
-            p0->V = g0->V;
             CrossPBC(p0);
             // if (updatebox)  p0->UpdateBox(D);
         }
@@ -2433,77 +2407,70 @@ inline void DELBM::UpdateXbrForRWM()
 
 inline void DELBM::SolveOneStepVAM(int demNt, bool save, int ct)
 {
-    cout << "DomLBM->CollideSRT();" << endl;
-    clock_t t_start = std::clock();
-    DomLBM->CollideSRT();
-    clock_t t_end = std::clock();
-    cout << "CollideSRT time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-    cout << "ApplyVAM;" << endl;
-    t_start = std::clock();
-    ApplyVAM();
-    t_end = std::clock();
-    cout << "ApplyVAM time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-    cout << "DomLBM->Stream();" << endl;
-    t_start = std::clock();
-    DomLBM->Stream();
-    t_end = std::clock();
-    cout << "Stream time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
+    {
+        PROFILE_SCOPE("DELBM::CollideSRT");
+        DomLBM->CollideSRT();
+    }
+    {
+        PROFILE_SCOPE("DELBM::ApplyVAM");
+        ApplyVAM();
+    }
+    {
+        PROFILE_SCOPE("DELBM::Stream");
+        DomLBM->Stream();
+    }
     // DomLBM->SetPeriodic(false, false, false);
     // DomLBM->SetWall();
-    cout << "DomLBM->ApplyWall();" << endl;
-    t_start = std::clock();
-    DomLBM->ApplyWall();
-    t_end = std::clock();
-    cout << "ApplyWall time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-    cout << "MoveVAM;" << endl;
-    // DomDEM->Contact();
-    t_start = std::clock();
-    DomDEM->Dt = 1./demNt;
-    bool saveFc = false;
-    for (int demt=0; demt<demNt; ++demt)
     {
-        // cout << "UpdateXmirGlobal;" << endl;
-        DomDEM->UpdateXmirGlobal();
-        // cout << "finishi UpdateXmirGlobal;" << endl;
-        if (demt==0)
-        {
-            UpdateXbrForRWM();
-        }
-        if (demt==demNt-1)
+        PROFILE_SCOPE("DELBM::ApplyWall");
+        DomLBM->ApplyWall();
+    }
+    {
+        PROFILE_SCOPE("DELBM::MoveVAM");
+        // DomDEM->Contact();
+        DomDEM->Dt = 1./demNt;
+        bool saveFc = false;
+        for (int demt=0; demt<demNt; ++demt)
         {
-            // if (save)   saveFc = true;
+            if (demt==0)
+            {
+                UpdateXbrForRWM();
+            }
+            if (demt==demNt-1)
+            {
+                // if (save)   saveFc = true;
+            }
+            DomDEM->Contact(saveFc, ct);
+            // DomDEM->Move();
+            MoveVAM();
+            DomDEM->ZeroForceTorque(false, true);
         }
-        DomDEM->Contact(saveFc, ct);
-        // DomDEM->Move();
-        MoveVAM();
-        DomDEM->ZeroForceTorque(false, true);
+        DomDEM->Lc.clear();
+    }
+    if (UseRW)
+    {
+        PROFILE_SCOPE("DELBM::MoveRW");
+        // DomRWM->Move();
+        MoveRW();
     }
-    DomDEM->Lc.clear();
-    cout << "satert DomRWM->Move()" << endl;
-    // if (UseRW)   DomRWM->Move();
-    if (UseRW)   MoveRW();
-    cout << "DomRWM->Move()" << endl;
     if (save)
     {
+        PROFILE_SCOPE("DELBM::WriteFile");
         // DomLBM->WriteFileH5(ct, 1);
         // DomDEM->WriteFileH5(ct);
         if (UseRW)  DomRWM->CalC();
-        cout << "DomRWM->CalC()" << endl;
         WriteFileH5(ct, 1);
-        cout << "WriteFileH5" << endl;
     }
-    UpdateBoxGlobal();
-    cout << "UpdateBoxGlobal" << endl;
-    // DomDEM->WriteFileParticleInfo(ct);
-    DomDEM->ZeroForceTorque(true, true);
-    t_end = std::clock();
-    cout << "MoveVAM time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-
-    cout << "DomLBM->CalRhoV();" << endl;
-    t_start = std::clock();
-    DomLBM->CalRhoV();
-    t_end = std::clock();
-    cout << "CalRhoV time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
+    {
+        PROFILE_SCOPE("DELBM::UpdateBoxGlobal");
+        UpdateBoxGlobal();
+        // DomDEM->WriteFileParticleInfo(ct);
+        DomDEM->ZeroForceTorque(true, true);
+    }
+    {
+        PROFILE_SCOPE("DELBM::CalRhoV");
+        DomLBM->CalRhoV();
+    }
 }
 
 inline void DELBM::SolveVAM(int tt, int savet, int demNt)
@@ -2511,9 +2478,14 @@ inline void DELBM::SolveVAM(int tt, int savet, int demNt)
     for (int t=0; t<tt; ++t)
     {
         bool save = false;
-        if (t%savet==0)    save = true;
+        if (t%savet==0)
+        {
+            save = true;
+            cout << "Time Step ============ " << t << endl;
+        }
         SolveOneStepVAM(demNt, save, t);
     }
+    PROFILE_WRITE("DELBM_Profile");
 }
 
 // inline void DELBM::SolveOneStepPSM(int demNt)
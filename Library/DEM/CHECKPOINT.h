@@ -0,0 +1,272 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Binary serialization of DEM particles for checkpoint/restart.
+// Values are stored as raw bytes, so a restart continues bit-exactly on the same machine and build.
+
+template<typename T>
+inline void WriteBin(ofstream& out, const T& a)
+{
+	out.write(reinterpret_cast<const char*>(&a), sizeof(T));
+}
+
+template<typename T>
+inline void ReadBin(ifstream& in, T& a)
+{
+	in.read(reinterpret_cast<char*>(&a), sizeof(T));
+}
+
+template<typename T, int R, int C>
+inline void WriteBin(ofstream& out, const Matrix<T, R, C>& a)
+{
+	size_t n = a.size();
+	WriteBin(out, n);
+	out.write(reinterpret_cast<const char*>(a.data()), n*sizeof(T));
+}
+
+template<typename T, int R, int C>
+inline void ReadBin(ifstream& in, Matrix<T, R, C>& a)
+{
+	size_t n;
+	ReadBin(in, n);
+	if (R==Dynamic)		a.resize(n);
+	in.read(reinterpret_cast<char*>(a.data()), n*sizeof(T));
+}
+
+template<typename T>
+inline void WriteBin(ofstream& out, const vector<T>& a)
+{
+	size_t n = a.size();
+	WriteBin(out, n);
+	for (size_t i=0; i<n; ++i)	WriteBin(out, a[i]);
+}
+
+template<typename T>
+inline void ReadBin(ifstream& in, vector<T>& a)
+{
+	size_t n;
+	ReadBin(in, n);
+	a.resize(n);
+	for (size_t i=0; i<n; ++i)	ReadBin(in, a[i]);
+}
+
+inline void WriteBin(ofstream& out, const vector<double>& a)
+{
+	size_t n = a.size();
+	WriteBin(out, n);
+	out.write(reinterpret_cast<const char*>(a.data()), n*sizeof(double));
+}
+
+inline void ReadBin(ifstream& in, vector<double>& a)
+{
+	size_t n;
+	ReadBin(in, n);
+	a.resize(n);
+	in.read(reinterpret_cast<char*>(a.data()), n*sizeof(double));
+}
+
+inline void WriteBin(ofstream& out, const unordered_map<size_t, Vector3d>& a)
+{
+	size_t n = a.size();
+	WriteBin(out, n);
+	for (auto it=a.begin(); it!=a.end(); ++it)
+	{
+		WriteBin(out, it->first);
+		WriteBin(out, it->second);
+	}
+}
+
+inline void ReadBin(ifstream& in, unordered_map<size_t, Vector3d>& a)
+{
+	size_t n;
+	ReadBin(in, n);
+	a.clear();
+	a.reserve(n);
+	for (size_t i=0; i<n; ++i)
+	{
+		size_t key;
+		Vector3d v;
+		ReadBin(in, key);
+		ReadBin(in, v);
+		a[key] = v;
+	}
+}
+
+// All members of a particle, including accelerations of the last step, fixes, constraints and the LBM boundary lists
+inline void WriteParticle(ofstream& out, DEM_PARTICLE* p0)
+{
+	WriteBin(out, p0->Type);
+	WriteBin(out, p0->ID);
+	WriteBin(out, p0->Tag);
+	WriteBin(out, p0->Group);
+	WriteBin(out, p0->MID);
+	WriteBin(out, p0->Nfe);
+
+	WriteBin(out, p0->Rho);
+	WriteBin(out, p0->R);
+	WriteBin(out, p0->Rb);
+	WriteBin(out, p0->M);
+	WriteBin(out, p0->Vol);
+	WriteBin(out, p0->Kn);
+	WriteBin(out, p0->Kt);
+	WriteBin(out, p0->Gn);
+	WriteBin(out, p0->Gt);
+	WriteBin(out, p0->Young);
+	WriteBin(out, p0->Poisson);
+
+	WriteBin(out, p0->Max);
+	WriteBin(out, p0->Min);
+	WriteBin(out, p0->BoxL);
+	WriteBin(out, p0->Coef0);
+	WriteBin(out, p0->Coef);
+
+	WriteBin(out, p0->P0);
+	WriteBin(out, p0->Ps);
+	WriteBin(out, p0->P);
+	WriteBin(out, p0->Edges);
+	WriteBin(out, p0->Faces);
+	WriteBin(out, p0->Adj);
+
+	WriteBin(out, p0->X0);
+	WriteBin(out, p0->X);
+	WriteBin(out, p0->Xbr);
+	WriteBin(out, p0->Xb);
+	WriteBin(out, p0->V);
+	WriteBin(out, p0->W);
+	WriteBin(out, p0->I);
+	WriteBin(out, p0->G);
+	WriteBin(out, p0->Fh);
+	WriteBin(out, p0->Fc);
+	WriteBin(out, p0->Fex);
+	WriteBin(out, p0->Th);
+	WriteBin(out, p0->Tc);
+	WriteBin(out, p0->Tex);
+	WriteBin(out, p0->Avb);
+	WriteBin(out, p0->Awb);
+	WriteBin(out, p0->Vf);
+	WriteBin(out, p0->Vc);
+	WriteBin(out, p0->Wf);
+	WriteBin(out, p0->Normal);
+
+	WriteBin(out, p0->removed);
+	WriteBin(out, p0->fixV);
+	WriteBin(out, p0->fixW);
+	WriteBin(out, p0->fixed);
+	WriteBin(out, p0->PValid);
+	WriteBin(out, p0->crossing);
+	WriteBin(out, p0->crossingFlag);
+	WriteBin(out, p0->constrained);
+
+	WriteBin(out, p0->Q.coeffs());
+	WriteBin(out, p0->Q0.coeffs());
+	WriteBin(out, p0->Qf.coeffs());
+	WriteBin(out, p0->Qfi.coeffs());
+
+	WriteBin(out, p0->Lb);
+	WriteBin(out, p0->Ln);
+	WriteBin(out, p0->Lq);
+	WriteBin(out, p0->Lp);
+	WriteBin(out, p0->Ld);
+	WriteBin(out, p0->Li);
+	WriteBin(out, p0->Lo);
+	WriteBin(out, p0->Lr);
+}
+
+inline DEM_PARTICLE* ReadParticle(ifstream& in)
+{
+	Vector3d x (0., 0., 0.);
+	DEM_PARTICLE* p0 = new DEM_PARTICLE(0, x, 0.);
+
+	ReadBin(in, p0->Type);
+	ReadBin(in, p0->ID);
+	ReadBin(in, p0->Tag);
+	ReadBin(in, p0->Group);
+	ReadBin(in, p0->MID);
+	ReadBin(in, p0->Nfe);
+
+	ReadBin(in, p0->Rho);
+	ReadBin(in, p0->R);
+	ReadBin(in, p0->Rb);
+	ReadBin(in, p0->M);
+	ReadBin(in, p0->Vol);
+	ReadBin(in, p0->Kn);
+	ReadBin(in, p0->Kt);
+	ReadBin(in, p0->Gn);
+	ReadBin(in, p0->Gt);
+	ReadBin(in, p0->Young);
+	ReadBin(in, p0->Poisson);
+
+	ReadBin(in, p0->Max);
+	ReadBin(in, p0->Min);
+	ReadBin(in, p0->BoxL);
+	ReadBin(in, p0->Coef0);
+	ReadBin(in, p0->Coef);
+
+	ReadBin(in, p0->P0);
+	ReadBin(in, p0->Ps);
+	ReadBin(in, p0->P);
+	ReadBin(in, p0->Edges);
+	ReadBin(in, p0->Faces);
+	ReadBin(in, p0->Adj);
+
+	ReadBin(in, p0->X0);
+	ReadBin(in, p0->X);
+	ReadBin(in, p0->Xbr);
+	ReadBin(in, p0->Xb);
+	ReadBin(in, p0->V);
+	ReadBin(in, p0->W);
+	ReadBin(in, p0->I);
+	ReadBin(in, p0->G);
+	ReadBin(in, p0->Fh);
+	ReadBin(in, p0->Fc);
+	ReadBin(in, p0->Fex);
+	ReadBin(in, p0->Th);
+	ReadBin(in, p0->Tc);
+	ReadBin(in, p0->Tex);
+	ReadBin(in, p0->Avb);
+	ReadBin(in, p0->Awb);
+	ReadBin(in, p0->Vf);
+	ReadBin(in, p0->Vc);
+	ReadBin(in, p0->Wf);
+	ReadBin(in, p0->Normal);
+
+	ReadBin(in, p0->removed);
+	ReadBin(in, p0->fixV);
+	ReadBin(in, p0->fixW);
+	ReadBin(in, p0->fixed);
+	ReadBin(in, p0->PValid);
+	ReadBin(in, p0->crossing);
+	ReadBin(in, p0->crossingFlag);
+	ReadBin(in, p0->constrained);
+
+	ReadBin(in, p0->Q.coeffs());
+	ReadBin(in, p0->Q0.coeffs());
+	ReadBin(in, p0->Qf.coeffs());
+	ReadBin(in, p0->Qfi.coeffs());
+
+	ReadBin(in, p0->Lb);
+	ReadBin(in, p0->Ln);
+	ReadBin(in, p0->Lq);
+	ReadBin(in, p0->Lp);
+	ReadBin(in, p0->Ld);
+	ReadBin(in, p0->Li);
+	ReadBin(in, p0->Lo);
+	ReadBin(in, p0->Lr);
+	return p0;
+}
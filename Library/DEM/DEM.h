@@ -20,8 +20,25 @@
 #include "../HEADER.h"
 #include <DEM_PARTICLE.h>
 #include <GJK.h>
+#include <HGRID.h>
+#include <PACKING.h>
+#include <CHECKPOINT.h>
+#include <PROBE.h>
 // #include <2D_PDEM_FUNCTIONS.h>
 
+// Kinematic state of a particle, used to repeat a rejected step of adaptive time stepping
+struct DEM_STATE
+{
+	Vector3d 						X;
+	Vector3d 						V;
+	Vector3d 						W;
+	Vector3d 						Avb;
+	Vector3d 						Awb;
+	Vector3d 						Fh;
+	Vector3d 						Th;
+	Quaterniond 					Q;
+};
+
 class DEM
 {
 public:
@@ -33,18 +50,27 @@ public:
 	void AddTetrahedron(int tag, vector<Vector3d> ver, double rho);
 	void AddDisk2D(int tag, double r, Vector3d& x, double rho);
 	void AddNSpheres(int tag, int np, Vector3d& x0, Vector3d& x1, double r, double surDis, double rho);
+	void AddClump(int tag, vector<Vector3d>& x, vector<double>& r, double rho);				// Add a rigid clump of spheres (disks in 2D) with centres x and radii r
+	void SetClump(DEM_PARTICLE* g0);														// Mass, centre of mass, principal inertia and member offsets of a group
+	void ClumpForce(DEM_PARTICLE* g0);														// Sum forces and torques of members to the group
+	void ClumpMembers(DEM_PARTICLE* g0);													// Move members with the rigid motion of the group
+	void AddPacking(PACKING& pack, double rho);												// Add all particles of a packing as spheres (disks in 2D)
 	void Add2DPolynomialParticle(int tag, VectorXd& coef, Vector3d& x, double rho);
 	void Move();
+	void MoveParticle(DEM_PARTICLE* p0);													// Move a single particle (not in a group) with Dt
 	void ZeroForceTorque(bool h, bool c);
 	void SetG(Vector3d& g);
 	double EffectiveValue(double ai, double aj);											// Calculate effective values for contact force
 	void RecordX();																			// Record position at Xb for check refilling LBM nodes
-	void Contact2P(DEM_PARTICLE* pi, DEM_PARTICLE* pj, Vector3d& xi, Vector3d& xir, bool& contacted);
+	void Contact2P(DEM_PARTICLE* pi, DEM_PARTICLE* pj, Vector3d& xi, Vector3d& xir, Vector3d& xs, bool& contacted);
+	template<int CM, int DM>
+	void ContactSpheres(DEM_PARTICLE* pi, DEM_PARTICLE* pj, Vector3d& xi, bool& contacted);	// Fast path of Contact2P for sphere (disk) pairs
+	template<int CM, int DM>
+	void ContactList(unordered_map<size_t, Vector3d>& fmap, unordered_map<size_t, Vector3d>& rmap, unordered_map<size_t, Vector3d>& smap);
 	void Friction(DEM_PARTICLE* pi, DEM_PARTICLE* pj, double delta, double kt, double gt, Vector3d& n, Vector3d& fn, Vector3d& xi, Vector3d& ft);
 	void RollingResistance(DEM_PARTICLE* pi, DEM_PARTICLE* pj, double delta, double kr, double gr, Vector3d& n, Vector3d& fn, Vector3d& xir, Vector3d& armr);
 	void UpdateFlag(DEM_PARTICLE* p0);
-	void UpdateXmir(DEM_PARTICLE* p0);
-	void UpdateXmirGlobal();
+	void MinimumImage(Vector3d& dx);														// Shift a relative position to its closest periodic image
 	void FindContact();
 	void FindContactBasedOnNode(bool first);
 	void Contact(bool writeFc, int n);
@@ -55,11 +81,21 @@ public:
 	void DampingParaDoNothing(double& kn, double& me, double& gn, double& gt);
 	void SetLubrication(double hn, double viscosity);
 	void Solve(int tt, int ts, double dt, bool writefile);
+	void SolveAdaptive(double tt, double ts, double dt0, bool writefile);					// Solve until time tt with adaptive (multi-rate) time steps, output every ts
+	void RecordContactDt(DEM_PARTICLE* pi, DEM_PARTICLE* pj, double kn);					// Record the time scale of a contact for adaptive time stepping
+	void OverlapInLc(vector<double>& ov);													// Overlap/radius of sphere and wall pairs in Lc
+	void SaveState(DEM_PARTICLE* p0, DEM_STATE& st);
+	void RestoreState(DEM_PARTICLE* p0, DEM_STATE& st);
 	void DeleteParticles();
+	void SortParticles();																	// Reorder particles along a Morton curve for cache locality
 	void LoadDEMFromH5( string fname, double scale, double rhos);
 	void WriteFileH5(int n);
 	void WriteContactForceFileH5(int n);
-	void WriteFileParticleInfo(int n);
+	void AddProbe(size_t id);																// Record the time series of particle id, see DEM_PROBE
+	void AddProbeTag(int tag);																// Record the time series of all particles with tag
+	void WriteFileParticleInfo(int n);														// Record the state of probed particles at step n (time n*Dt)
+	void WriteCheckpoint(string fname);													// Write the full state (particles, groups, contact histories) for a bit-exact restart
+	void ReadCheckpoint(string fname);
 
 	void (DEM::*ContactPara)(DEM_PARTICLE* pi, DEM_PARTICLE* pj, double delta, double& kn, double& gn, double& kt, double& gt);
 	void (DEM::*DampingPara)(double& kn, double& me, double& gn, double& gt);
@@ -67,17 +103,32 @@ public:
 	bool 							Periodic[3];
 
 	size_t 							Nproc;
+	size_t 							SortInterval;											// Steps between two Morton reorderings of Lp, 0 for never
+	int 							Step;													// Time step of Solve, the next Solve starts from it (set by ReadCheckpoint)
+	double 							CheckpointInterval;										// Wall time (s) between two checkpoints written by Solve, 0 for never
+	size_t 							ProbeInterval;											// Steps between two records of probed particles, 0 for never
+	DEM_PROBE 						Probe;													// Buffered time series of tracer particles
     size_t 							D;														// Dimension
     int 							Nx;														// Mesh size for contact detection
     int 							Ny;
     int 							Nz;
     string 							CMType;
     string 							DMType;
+    int 							CMID;													// Contact model ID, 0 for LINEAR and 1 for HERTZ
+    int 							DMID;													// Damping model ID, 0 for DEFULT and 1 for CR/LOG
 
     int 							DomSize[3];
     size_t 							Np;														// Total number of points in the domain
     size_t 							Nf;														// Total number of faces in the domain
     double 							Dt;														// Time step
+    double 							DtMin;													// Minimum time step of adaptive time stepping
+    double 							DtMax;													// Maximum time step of adaptive time stepping
+    double 							CoefDtContact;											// Ratio of time step to sqrt(me/kn) of the stiffest contact
+    double 							CoefDtMove;												// Ratio of displacement per step to the smallest radius
+    double 							OverlapTol;												// Sub-steps increasing an overlap/radius by more than it are rejected
+    double 							MinContactDt;											// Min sqrt(me/kn) of contacts since last reset
+    bool 							MultiRate;												// Only particles which may contact use sub-steps
+    bool 							TrackDt;												// Record MinContactDt in contact functions
     double 							Cr;														// Coefficient of restitution
 	double 							Beta;					
 	double 							RatioGnt;												// Gt/Gn
@@ -88,6 +139,8 @@ public:
 
 	vector<Vector3i> 				Ne;														// Relative location of neighbor cells
 
+	HGRID 							Hgrid;													// Hierarchical grid for contact detection
+
     vector<size_t>***		 		Flag;													// Flag of lattice type
     vector<size_t>***		 		Flagt;													// Flag of lattice type
 
@@ -98,6 +151,7 @@ public:
 	unordered_map<size_t, bool> 	CMap;													// Contact Map
 	unordered_map<size_t, Vector3d> FMap;													// Friction Map
 	unordered_map<size_t, Vector3d> RMap;													// Rolling resistance Map
+	unordered_map<size_t, Vector3d> SMap;													// Separating axis Map of polyhedron pairs (GJK warm start)
 
 	double 							FsTable[10][10];										// Friction coefficient (static) table
 	double 							FdTable[10][10];										// Friction coefficient (dynamic) table
@@ -140,6 +194,19 @@ inline DEM::DEM(int nx, int ny, int nz, string cmtype, string dmtype, double cr)
 	}
 
 	Nproc = 1;
+	SortInterval = 0;
+	Step = 0;
+	CheckpointInterval = 0.;
+	ProbeInterval = 0;
+
+	DtMin = 1.0e-6;
+	DtMax = 1.;
+	CoefDtContact = 0.2;
+	CoefDtMove = 0.1;
+	OverlapTol = 0.05;
+	MinContactDt = 1.0e300;
+	MultiRate = false;
+	TrackDt = false;
 
 	Periodic[0] = true;
 	Periodic[1] = true;
@@ -154,10 +221,13 @@ inline DEM::DEM(int nx, int ny, int nz, string cmtype, string dmtype, double cr)
 
 	CMType = cmtype;
 	DMType = dmtype;
+	CMID = 0;
+	DMID = 0;
 
 	if (CMType=="LINEAR")
 	{
 		ContactPara =& DEM::LinearContactPara;
+		CMID = 0;
 		cout << "Using Linear contact model." << endl;
 		if (DMType=="DEFULT")
 		{
@@ -167,6 +237,7 @@ inline DEM::DEM(int nx, int ny, int nz, string cmtype, string dmtype, double cr)
 		else if (DMType=="CR")
 		{
 			DampingPara =& DEM::HertzDampingPara0;
+			DMID = 1;
 			cout << "Using Coefficient of restitution for Linear damping model." << endl;
 		}
 		else
@@ -178,6 +249,7 @@ inline DEM::DEM(int nx, int ny, int nz, string cmtype, string dmtype, double cr)
 	else if (CMType=="HERTZ")
 	{
 		ContactPara =& DEM::HertzContactPara;
+		CMID = 1;
 		cout << "Using Hertz Contact model." << endl;
 		if (DMType=="DEFULT")
 		{
@@ -187,6 +259,7 @@ inline DEM::DEM(int nx, int ny, int nz, string cmtype, string dmtype, double cr)
 		else if (DMType=="LOG")
 		{
 			DampingPara =& DEM::HertzDampingPara0;
+			DMID = 1;
 			cout << "Using eq: log(Cr)*me for Hertz damping model." << endl;
 		}
 		else
@@ -210,11 +283,23 @@ inline DEM::DEM(int nx, int ny, int nz, string cmtype, string dmtype, double cr)
 
 // Map a pair of integer to one integer key for hashing
 // https://en.wikipedia.org/wiki/Pairing_function#Cantor_pairing_function
-inline size_t Key(int i, int j)
+inline size_t Key(size_t i, size_t j)
 {
 	return (i+j+1)*(i+j)/2+j;
 }
 
+// Inverse of the Cantor pairing function
+inline void InverseKey(size_t key, size_t& i, size_t& j)
+{
+	size_t w = (size_t) ((sqrt(8.*(double) key+1.)-1.)/2.);
+	// correct round-off of sqrt for large keys
+	while (w*(w+1)/2>key)			--w;
+	while ((w+1)*(w+2)/2<=key)		++w;
+	size_t t = w*(w+1)/2;
+	j = key-t;
+	i = w-j;
+}
+
 inline void DEM::Init()
 {
     cout << "================ Start init. ================" << endl;
@@ -385,62 +470,172 @@ inline void DEM::AddTetrahedron(int tag, vector<Vector3d> ver, double rho)
 
 inline void DEM::AddNSpheres(int tag, int np, Vector3d& x0, Vector3d& x1, double r, double surDis, double rho)
 {
-    srand (time(NULL));
-    int count = 0;
+	PACKING pack(D, x0, x1);
+	pack.Nproc = Nproc;
+	pack.Seed = time(NULL);
+	pack.SurDis = surDis;
+	pack.Margin = 1.;
+	pack.SetRadius(r);
+	// existing particles are obstacles
+	for (size_t p=6; p<Lp.size(); ++p)	pack.Add(Lp[p]->X, Lp[p]->R, Lp[p]->Tag);
+	size_t n0 = pack.X.size();
+	pack.RSA(np, tag, 100000);
+	for (size_t i=n0; i<pack.X.size(); ++i)
+	{
+		if (D==3)		AddSphere(tag, pack.R[i], pack.X[i], rho);
+		else if (D==2)	AddDisk2D(tag, pack.R[i], pack.X[i], rho);
+	}
+}
+
+inline void DEM::AddPacking(PACKING& pack, double rho)
+{
+	for (size_t i=0; i<pack.X.size(); ++i)
+	{
+		if (D==3)		AddSphere(pack.Tag[i], pack.R[i], pack.X[i], rho);
+		else if (D==2)	AddDisk2D(pack.Tag[i], pack.R[i], pack.X[i], rho);
+	}
+}
 
-    Vector3d l = x1-x0;
-    cout << l.transpose() << endl;
-    for (int n=0; n<1.0e200; n++)
-    {
-        Vector3d pos(0.,0.,0.);
-        for (size_t d=0; d<D; ++d)
-        {
-        	pos(d) = (l(d)-2*(r+1))*((double)rand()/RAND_MAX) + (r+1);
-        }
-        // pos(0) = (l(0)-2*(r+1))*((double)rand()/RAND_MAX) + (r+1);
-        // pos(1) = (l(1)-2*(r+1))*((double)rand()/RAND_MAX) + (r+1);
-        // pos(2) = (l(2)-2*(r+1))*((double)rand()/RAND_MAX) + (r+1);
-        pos += x0;
-        bool boolContact = false;
-
-        if (Lp.size()>6)
-        {
-            // #pragma omp parallel for schedule(static) num_threads(Nproc)
-            for (size_t p=6; p<Lp.size(); ++p)
-            {
-                Vector3d xpq = Lp[p]->X - pos;
-                double pqDis = xpq.norm() - r - Lp[p]->R;
-                // cout << "pqDis: " << pqDis << endl;
-                // cout << "Lp[p]->X: " << Lp[p]->X.transpose() << endl;
-                // cout << "pos: " << pos.transpose() << endl;
-                if (pqDis<surDis)
-                {
-                	boolContact = true;
-                	break;
-                }
-            }
-        }
-        if (boolContact==false)   
-        {
-            if (D==3)		AddSphere(tag, r, pos, rho);
-            else if (D==2)	AddDisk2D(tag, r, pos, rho);
-            count++;
-            cout << "Already add " << count << " particles" << endl;
-            // for (size_t p=2*D; p<Lp.size()-1; ++p)
-            // {
-            //     Vector3d xpq = Lp[Lp.size()-1]->X - Lp[p]->X;
-            //     double pqDis = xpq.norm() - Lp[Lp.size()-1]->R - Lp[p]->R;
-            //     if (pqDis<surDis)
-            //     {
-            //     	cout << "contacted" << endl;
-            //     	cout << pqDis << endl;
-            //     	abort();
-            //     }           
-            // }
-        }
-
-        if (count>=np)   break;
-    }
+// Rigid clump of spheres (disks in 2D), members are stored in Lp with Group set and move with the group Lg[Group].
+// Member overlaps are not subtracted from the mass and inertia, contacts between members of the same clump are skipped.
+inline void DEM::AddClump(int tag, vector<Vector3d>& x, vector<double>& r, double rho)
+{
+	if (x.size()!=r.size() || x.size()==0)
+	{
+		cout << "\033[1;31mError: Sizes of positions and radii of a clump are not the same.\033[0m\n";
+		exit(0);
+	}
+	Vector3d x0 (0., 0., 0.);
+	DEM_PARTICLE* g0 = new DEM_PARTICLE(tag, x0, rho);
+	g0->ID = Lg.size();
+	for (size_t l=0; l<x.size(); ++l)
+	{
+		if (D==3)		AddSphere(tag, r[l], x[l], rho);
+		else if (D==2)	AddDisk2D(tag, r[l], x[l], rho);
+		Lp[Lp.size()-1]->Group = Lg.size();
+		g0->Lp.push_back(Lp.size()-1);
+	}
+	Lg.push_back(g0);
+	SetClump(g0);
+	ClumpMembers(g0);
+}
+
+inline void DEM::SetClump(DEM_PARTICLE* g0)
+{
+	size_t n = g0->Lp.size();
+	if (n==0)	return;
+	// positions relative to the first member, so a clump crossing a periodic boundary stays in one piece
+	Vector3d x0 = Lp[g0->Lp[0]]->X;
+	vector<Vector3d> dx (n);
+	double m = 0.;
+	double vol = 0.;
+	Vector3d xc (0., 0., 0.);
+	for (size_t l=0; l<n; ++l)
+	{
+		DEM_PARTICLE* p0 = Lp[g0->Lp[l]];
+		dx[l] = p0->X-x0;
+		MinimumImage(dx[l]);
+		m += p0->M;
+		vol += p0->Vol;
+		xc += p0->M*dx[l];
+	}
+	xc /= m;
+	// inertia tensor about the centre of mass under lab frame
+	Matrix3d it = Matrix3d::Zero();
+	double rb = 0.;
+	for (size_t l=0; l<n; ++l)
+	{
+		DEM_PARTICLE* p0 = Lp[g0->Lp[l]];
+		Vector3d r = dx[l]-xc;
+		Matrix3d rot = p0->Qf.toRotationMatrix();
+		it += rot*p0->I.asDiagonal()*rot.transpose();
+		it += p0->M*(r.squaredNorm()*Matrix3d::Identity()-r*r.transpose());
+		rb = max(rb, r.norm()+p0->Rb);
+	}
+	// principal axes, in 2D the z axis is kept so the clump rotates in plane
+	Matrix3d ev = Matrix3d::Identity();
+	Vector3d iv = it.diagonal();
+	if (D==2)
+	{
+		// closed form rotation that diagonalises the in-plane block
+		double th = 0.5*atan2(2.*it(1,0), it(0,0)-it(1,1));
+		double cs = cos(th);
+		double sn = sin(th);
+		ev(0,0) = cs;	ev(0,1) = -sn;
+		ev(1,0) = sn;	ev(1,1) = cs;
+		iv(0) = it(0,0)*cs*cs+2.*it(1,0)*sn*cs+it(1,1)*sn*sn;
+		iv(1) = it(0,0)*sn*sn-2.*it(1,0)*sn*cs+it(1,1)*cs*cs;
+	}
+	else
+	{
+		SelfAdjointEigenSolver<Matrix3d> es(it);
+		ev = es.eigenvectors();
+		iv = es.eigenvalues();
+	}
+	if (ev.determinant()<0.)	ev.col(0) *= -1.;
+
+	g0->X = x0+xc;
+	g0->M = m;
+	g0->Vol = vol;
+	g0->I = iv;
+	g0->R = rb;
+	g0->Rb = rb;
+	g0->Q0 = Quaterniond(ev);
+	g0->Q.w() = 1.;
+	g0->Q.vec() << 0., 0., 0.;
+	g0->Qf = g0->Q0*g0->Q;
+	g0->Qfi = g0->Qf.inverse();
+	g0->Lo.resize(n);
+	g0->Lr.resize(n);
+	for (size_t l=0; l<n; ++l)
+	{
+		g0->Lo[l] = g0->Qfi._transformVector(dx[l]-xc);
+		g0->Lr[l] = g0->Qfi*Lp[g0->Lp[l]]->Qf;
+	}
+}
+
+inline void DEM::ClumpForce(DEM_PARTICLE* g0)
+{
+	Vector3d fh (0., 0., 0.);
+	Vector3d fc (0., 0., 0.);
+	Vector3d th (0., 0., 0.);											// torques about the centre of mass under lab frame
+	Vector3d tc (0., 0., 0.);
+	for (size_t l=0; l<g0->Lp.size(); ++l)
+	{
+		DEM_PARTICLE* p0 = Lp[g0->Lp[l]];
+		Vector3d r = g0->Qf._transformVector(g0->Lo[l]);
+		fh += p0->Fh;
+		fc += p0->Fc;
+		th += r.cross(p0->Fh)+p0->Qf._transformVector(p0->Th);
+		tc += r.cross(p0->Fc)+p0->Qf._transformVector(p0->Tc);
+	}
+	g0->Fh = fh;
+	g0->Fc = fc;
+	g0->Th = g0->Qfi._transformVector(th);
+	g0->Tc = g0->Qfi._transformVector(tc);
+}
+
+inline void DEM::ClumpMembers(DEM_PARTICLE* g0)
+{
+	Vector3d w = g0->Qf._transformVector(g0->W);
+	for (size_t l=0; l<g0->Lp.size(); ++l)
+	{
+		DEM_PARTICLE* p0 = Lp[g0->Lp[l]];
+		Vector3d r = g0->Qf._transformVector(g0->Lo[l]);
+		// move by the shortest displacement so that periodic crossings are handled by the callers as for single particles
+		Vector3d dx = g0->X+r-p0->X;
+		MinimumImage(dx);
+		p0->Xb = p0->X;
+		p0->X += dx;
+		// members turn with the group so that non-spherical members keep their place in it
+		p0->Qf = g0->Qf*g0->Lr[l];
+		p0->Qfi = p0->Qf.inverse();
+		p0->Q = p0->Q0.inverse()*p0->Qf;
+		// the contact laws use W of members under lab frame
+		p0->V = g0->V+w.cross(r);
+		p0->W = w;
+		p0->PValid = false;
+	}
 }
 
 inline void DEM::Move()
@@ -449,38 +644,15 @@ inline void DEM::Move()
 	for (size_t i=6; i<Lp.size(); ++i)
 	{
 		DEM_PARTICLE* p0 = Lp[i];
-		if (p0->Group==-1)
-		{
-			if 		(p0->X(0)>Nx)	p0->X(0) = p0->X(0)-Nx-1;
-			else if (p0->X(0)<0.)	p0->X(0) = p0->X(0)+Nx+1;
-			if 		(p0->X(1)>Ny)	p0->X(1) = p0->X(1)-Ny-1;
-			else if (p0->X(1)<0.)	p0->X(1) = p0->X(1)+Ny+1;
-			if 		(p0->X(2)>Nz)	p0->X(2) = p0->X(2)-Nz-1;
-			else if (p0->X(2)<0.)	p0->X(2) = p0->X(2)+Nz+1;
-			p0->VelocityVerlet(Dt);
-			p0->UpdateBox(D);
-		}
-		else
-		{
-			// #pragma omp critical
-			// {
-			// 	Lg[p0->Group]->Fh += p0->Fh;
-			// 	Lg[p0->Group]->Fc += p0->Fc;
-			// }
-            for (size_t d=0; d<D; ++d)
-            {
-                #pragma omp atomic
-                Lg[p0->Group]->Fh(d) += p0->Fh(d);
-                #pragma omp atomic
-                Lg[p0->Group]->Fc(d) += p0->Fc(d);
-            }
-		}
+		if (p0->Group==-1)	MoveParticle(p0);
 	}
-	// cout << "Lg.size()= " << Lg.size() << endl;
-	// For groups, WORNING: rotation is not considered yet.
+	// Groups are rigid clumps, each one sums the forces of its own members so no atomics are needed
+	#pragma omp parallel for schedule(dynamic) num_threads(Nproc)
 	for (size_t i=0; i<Lg.size(); ++i)
 	{
 		DEM_PARTICLE* g0 = Lg[i];
+		if (g0->Lo.size()!=g0->Lp.size())	SetClump(g0);
+		ClumpForce(g0);
 		if 		(g0->X(0)>Nx)	g0->X(0) = g0->X(0)-Nx-1;
 		else if (g0->X(0)<0.)	g0->X(0) = g0->X(0)+Nx+1;
 		if 		(g0->X(1)>Ny)	g0->X(1) = g0->X(1)-Ny-1;
@@ -489,15 +661,10 @@ inline void DEM::Move()
 		else if (g0->X(2)<0.)	g0->X(2) = g0->X(2)+Nz+1;
 		g0->VelocityVerlet(Dt);
 		g0->UpdateBox(D);
-		Vector3d displace = g0->X - g0->Xb;
-		// cout << "g0->V= " << g0->V.transpose() << endl;
-
+		ClumpMembers(g0);
 		for (size_t l=0; l<g0->Lp.size(); ++l)
 		{
-			size_t p = g0->Lp[l];
-			DEM_PARTICLE* p0 = Lp[p];
-			p0->X += displace;
-			p0->V = g0->V;
+			DEM_PARTICLE* p0 = Lp[g0->Lp[l]];
 			if 		(p0->X(0)>Nx)	p0->X(0) = p0->X(0)-Nx-1;
 			else if (p0->X(0)<0.)	p0->X(0) = p0->X(0)+Nx+1;
 			if 		(p0->X(1)>Ny)	p0->X(1) = p0->X(1)-Ny-1;
@@ -509,6 +676,18 @@ inline void DEM::Move()
 	}
 }
 
+inline void DEM::MoveParticle(DEM_PARTICLE* p0)
+{
+	if 		(p0->X(0)>Nx)	p0->X(0) = p0->X(0)-Nx-1;
+	else if (p0->X(0)<0.)	p0->X(0) = p0->X(0)+Nx+1;
+	if 		(p0->X(1)>Ny)	p0->X(1) = p0->X(1)-Ny-1;
+	else if (p0->X(1)<0.)	p0->X(1) = p0->X(1)+Ny+1;
+	if 		(p0->X(2)>Nz)	p0->X(2) = p0->X(2)-Nz-1;
+	else if (p0->X(2)<0.)	p0->X(2) = p0->X(2)+Nz+1;
+	p0->VelocityVerlet(Dt);
+	p0->UpdateBox(D);
+}
+
 inline void DEM::ZeroForceTorque(bool h, bool c)
 {
 	#pragma omp parallel for schedule(static) num_threads(Nproc)
@@ -604,7 +783,7 @@ inline void DEM::SetLubrication(double hn, double viscosity)
 }
 
 // Contact force model for spheres
-inline void DEM::Contact2P(DEM_PARTICLE* pi, DEM_PARTICLE* pj, Vector3d& xi, Vector3d& xir, bool& contacted)
+inline void DEM::Contact2P(DEM_PARTICLE* pi, DEM_PARTICLE* pj, Vector3d& xi, Vector3d& xir, Vector3d& xs, bool& contacted)
 {
 	// cout << "contact start" << endl;
 	contacted = false;
@@ -620,32 +799,33 @@ inline void DEM::Contact2P(DEM_PARTICLE* pi, DEM_PARTICLE* pj, Vector3d& xi, Vec
 	}
 
 	Vector3d n = Xi-Xj;								// Normal direction (pj pinnts to pi)
+	Vector3d sh = n;
+	MinimumImage(n);								// Use the periodic image of pi which is closest to pj
+	sh = n-sh;										// Periodic shift of pi
+	Xi += sh;
 	Vector3d cpi, cpj;								// closest point on i and j, contact point
 	cpi = Xi; cpj = Xj;								// set to sphere center for sphere collisions
+	double dis = n.norm();							// Distance between cores
 	if (pi->Type==3 && pj->Type==3)					// For polyhedron collisions
 	{
-		FindClosestPoints3D(pi->P, pj->P, n, cpi, cpj);	// Find closest points
-		n = cpi-cpj;									// Contact normal
-		// cout << "cpi: " << cpi.transpose() << endl;
-		// cout << "cpj: " << cpj.transpose() << endl;
+		// start from the separating axis of last step
+		xs.setZero();
+		size_t key = Key(pi->ID, pj->ID);
+		auto it = SMap.find(key);
+		if (it!=SMap.end())	xs = it->second;
+		// lab frame vertices are only updated for particles which may contact (Contact2P is called in serial)
+		pi->UpdateP();
+		pj->UpdateP();
+		// Find closest points, stop as soon as the cores are proven to be farther than R_i+R_j
+		// dis is negative (penetration depth from EPA) if the cores overlap
+		if (!FindClosestPoints3D(pi->P, pj->P, pi->Adj, pj->Adj, sh, pi->R+pj->R, xs, cpi, cpj, dis))	return;
+		n = xs;											// Contact normal
+		if (n.squaredNorm()==0.)	n = Xi-Xj;
 	}
-	double delta = pi->R+pj->R-n.norm(); 			// Overlapping distance
+	double delta = pi->R+pj->R-dis; 				// Overlapping distance
 	n.normalize();									// Normalize contact normal
 	Vector3d cp = cpj+(pj->R-0.5*delta)*n;			// Contact point
 
-	if (pi->crossingFlag || pj->crossingFlag)
-	{
-		for (size_t i=0; i<pi->Xmir.size(); ++i)
-		for (size_t j=0; j<pj->Xmir.size(); ++j)
-		{
-			double deltat = pi->R+pj->R-(pi->Xmir[i]-pj->Xmir[j]).norm();
-			if (deltat>delta)
-			{
-				delta = deltat;
-				n = pi->Xmir[i]-pj->Xmir[j];
-			}
-		}
-	}
 	// cout << "delta: " << delta << endl;
 	// abort();
 	// report contact for updating friction map 
@@ -668,6 +848,7 @@ inline void DEM::Contact2P(DEM_PARTICLE* pi, DEM_PARTICLE* pj, Vector3d& xi, Vec
 		// }
 		double kn, gn, kt, gt;
 		(this->*ContactPara)(pi, pj, delta, kn, gn, kt, gt);
+		if (TrackDt)	RecordContactDt(pi, pj, kn);
 		Vector3d vn = (pj->V-pi->V).dot(n)*n;			// Relative velocity in normal direction
 		Vector3d fn= kn*delta*n + gn*vn;				// Normal contact force
 		Vector3d ft (0., 0., 0.);
@@ -700,6 +881,98 @@ inline void DEM::Contact2P(DEM_PARTICLE* pi, DEM_PARTICLE* pj, Vector3d& xi, Vec
 	}
 }
 
+// Contact force model for a pair of spheres (or disks).
+// Same physics as Contact2P, but the contact and damping models are resolved at compile time.
+// CM: 0 for LINEAR, 1 for HERTZ; DM: 0 for DEFULT, 1 for CR/LOG (only used by HERTZ, as in HertzContactPara)
+template<int CM, int DM>
+inline void DEM::ContactSpheres(DEM_PARTICLE* pi, DEM_PARTICLE* pj, Vector3d& xi, bool& contacted)
+{
+	contacted = false;
+	Vector3d n = pi->X-pj->X;						// Normal direction (pj pinnts to pi)
+	MinimumImage(n);
+	double rij = pi->R+pj->R;
+	double dis2 = n.squaredNorm();
+	if (dis2>=rij*rij)	return;						// Not contacted, skip the sqrt
+	double dis = sqrt(dis2);
+	double delta = rij-dis; 						// Overlapping distance
+	n /= dis;										// Normalize contact normal
+	contacted = true;
+
+	double kn, gn, kt, gt;
+	if (CM==0)
+	{
+		kn 	= 2.*EffectiveValue(pi->Kn, pj->Kn);
+		gn 	= 2.*EffectiveValue(pi->Gn, pj->Gn);
+		kt 	= 2.*EffectiveValue(pi->Kt, pj->Kt);
+		gt 	= RatioGnt*gn;
+	}
+	else
+	{
+		double re 	= EffectiveValue(pi->R, pj->R);
+		double me 	= EffectiveValue(pi->M, pj->M);
+		double ee 	= 1./((1.-pi->Poisson*pi->Poisson)/pi->Young + (1.-pj->Poisson*pj->Poisson)/pj->Young);
+		double ge 	= 1./(2.*(2.-pi->Poisson)*(1.+pi->Poisson)/pi->Young + 2.*(2.-pj->Poisson)*(1.+pj->Poisson)/pj->Young);
+		double sd 	= sqrt(re*delta);
+		kn 	= 1.3333333333333*ee*sd;
+		kt 	= 8.*ge*sd;
+		if (DM==0)
+		{
+			gn 	= -1.825741858351*Beta*sqrt(2.*ee*sd*me);
+			gt 	= -1.825741858351*Beta*sqrt(kt*me);
+		}
+		else
+		{
+			gn = -log(Cr)*me;
+			gt = RatioGnt*gn;
+		}
+	}
+	if (TrackDt)	RecordContactDt(pi, pj, kn);
+	Vector3d vn = (pj->V-pi->V).dot(n)*n;			// Relative velocity in normal direction
+	Vector3d fn= kn*delta*n + gn*vn;				// Normal contact force
+	Vector3d ft (0., 0., 0.);
+	Friction(pi, pj, delta, kt, gt, n, fn, xi, ft);	// Friction force and torque
+	Vector3d fnt = fn+ft;							// Total force
+	// The normal force has no arm for spheres, the torque is rotated to the object frame in one go
+	Vector3d ti = (pi->R-0.5*delta)*ft.cross(n);
+	Vector3d tj = (pj->R-0.5*delta)*ft.cross(n);
+	#pragma omp critical
+	{
+		pi->Fc += fnt;
+		pj->Fc -= fnt;
+		pi->Tc += pi->Qfi._transformVector(ti);
+		pj->Tc += pj->Qfi._transformVector(tj);
+	}
+}
+
+// Loop over the contact list, sphere pairs go to the fast path, others (walls, polyhedra) to Contact2P
+template<int CM, int DM>
+inline void DEM::ContactList(unordered_map<size_t, Vector3d>& fmap, unordered_map<size_t, Vector3d>& rmap, unordered_map<size_t, Vector3d>& smap)
+{
+	for (size_t l=0; l<Lc.size(); ++l)
+	{
+		int i = Lc[l][0];
+		int j = Lc[l][1];
+		DEM_PARTICLE* pi = Lp[i];
+		DEM_PARTICLE* pj = Lp[j];
+		if (pi->Group!=-1 && pi->Group==pj->Group)	continue;
+		bool contacted = false;
+		Vector3d xi (0.,0.,0.);
+		Vector3d xir (0.,0.,0.);
+		Vector3d xs (0.,0.,0.);
+		if ((pi->Type==1 || pi->Type==2) && pi->Type==pj->Type)
+		{
+			ContactSpheres<CM,DM>(pi, pj, xi, contacted);
+		}
+		else	Contact2P(pi, pj, xi, xir, xs, contacted);
+		if (pi->Type==3 && pj->Type==3)	smap[Key(i,j)] = xs;
+		if (contacted)
+		{
+			fmap[Key(i,j)] = xi;
+			rmap[Key(i,j)] = xir;
+		}
+	}
+}
+
 inline void DEM::Friction(DEM_PARTICLE* pi, DEM_PARTICLE* pj, double delta, double kt, double gt, Vector3d& n, Vector3d& fn, Vector3d& xi, Vector3d& ft)
 {
 	// Relative velocity at the contact point
@@ -759,73 +1032,20 @@ inline double DEM::EffectiveValue(double ai, double aj)
 	return (a);
 }
 
-// Update Xmir for periodic BC
-inline void DEM::UpdateXmir(DEM_PARTICLE* p0)
+// Minimum image convention for periodic BC, the period is DomSize+1 as particles are wrapped in Move
+inline void DEM::MinimumImage(Vector3d& dx)
 {
-	// cout << p0->X.transpose() << endl;
-	p0->Xmir.clear();
-	// add original position
-	Vector3d xmir0 = p0->X;
-	p0->Xmir.push_back(xmir0);
-	// cout << "1111111111111111" << endl;
-	// check crossing first
-	if (p0->crossingFlag)
-	{
-		// cout << "crossingFlag " << endl;
-		// cout << p0->X.transpose() << endl;
-		// list of periodic dircetion
-		vector<size_t> dirc;
-		for (size_t i=0; i<D; ++i)
-		{
-			if (p0->crossing[i])	dirc.push_back(i);
-		}
-		// add mirror position for first direction
-		size_t d0 = dirc[0];
-		Vector3d xmir = p0->X;
-		if (xmir(d0)+p0->R>DomSize[d0])		xmir(d0) -= DomSize[d0]+1;
-		else if (xmir(d0)-p0->R<0.)			xmir(d0) += DomSize[d0]+1;
-		p0->Xmir.push_back(xmir);
-		// cout << "222222222222222" << endl;
-		// add mirror position for second direction
-		if (dirc.size()>1)
-		{
-			size_t d1 = dirc[1];
-			// for every exiting mirror positions add a new one for this direction 2->4
-			for (size_t i=0; i<2; ++i)
-			{
-				Vector3d xmiri = p0->Xmir[i];
-				if (xmiri(d1)+p0->R>DomSize[d1])	xmiri(d1) -= DomSize[d1]+1;
-				else if (xmiri(d1)-p0->R<0.)		xmiri(d1) += DomSize[d1]+1;
-				p0->Xmir.push_back(xmiri);
-			}
-		}
-		// cout << "3333333333333" << endl;
-		// add mirror position for third direction
-		if (dirc.size()>2)
+	for (size_t d=0; d<D; ++d)
+	{
+		if (Periodic[d])
 		{
-			size_t d2 = dirc[2];
-			// for every exiting mirror positions add a new one for this direction 4->8
-			for (size_t i=0; i<4; ++i)
-			{
-				Vector3d xmiri = p0->Xmir[i];
-				if (xmiri(d2)+p0->R>DomSize[d2])	xmiri(d2) -= DomSize[d2]+1;
-				else if (xmiri(d2)-p0->R<0.)		xmiri(d2) += DomSize[d2]+1;
-				p0->Xmir.push_back(xmiri);
-			}
+			double l = DomSize[d]+1;
+			if 		(dx(d)> 0.5*l)	dx(d) -= l;
+			else if (dx(d)<-0.5*l)	dx(d) += l;
 		}
-		// cout << "4444444444444444" << endl;
 	}
 }
 
-inline void DEM::UpdateXmirGlobal()
-{
-	#pragma omp parallel for schedule(static) num_threads(Nproc)
-	for (size_t i=6; i<Lp.size(); ++i)
-	{
-		UpdateXmir(Lp[i]);
-	}	
-}
-
 inline void DEM::UpdateFlag(DEM_PARTICLE* p0)
 {
 	for (int i=p0->Min(0); i<=p0->Max(0); ++i)
@@ -959,44 +1179,42 @@ inline void DEM::UpdateFlag(DEM_PARTICLE* p0)
 //     // cout << "done flag" << endl;
 // }
 
+// Broad phase contact detection with the hierarchical grid, pairs with overlapping bounding spheres are appended to Lc
 inline void DEM::FindContact()
 {
 	CMap.clear();
-	#pragma omp parallel for schedule(static) num_threads(Nproc)
+	for (size_t d=0; d<3; ++d)
+	{
+		Hgrid.L[d] = DomSize[d]+1;
+		Hgrid.Periodic[d] = Periodic[d];
+	}
+	Hgrid.D = D;
+	Hgrid.Build(Lp, 6, Nproc);
+	Hgrid.FindPairs(Lp, 6, Nproc, Lc);
+	// Walls and periodic boundaries
 	for (size_t p=6; p<Lp.size(); ++p)
 	{
 		DEM_PARTICLE* p0 = Lp[p];
-
-		for (int i=p0->Min(0); i<=p0->Max(0); ++i)
-		for (int j=p0->Min(1); j<=p0->Max(1); ++j)
-		for (int k=p0->Min(2); k<=p0->Max(2); ++k)
+		double rb = p0->Rb+0.5*Hgrid.Skin;
+		for (size_t d=0; d<D; ++d)
 		{
-			int ic = (i+Nx+1)%(Nx+1);
-			int jc = (j+Ny+1)%(Ny+1);
-			int kc = (k+Nz+1)%(Nz+1);
-
-			if (Flag[ic][jc][kc].size()>0)
+			bool lower = p0->X(d)-rb<1.;
+			bool upper = p0->X(d)+rb>DomSize[d]-1.;
+			if (Periodic[d])
 			{
-				vector<size_t> flagtmp;
-				flagtmp.resize(0);
-				for (size_t m=0; m<Flag[ic][jc][kc].size(); ++m)
+				if (lower || upper)
 				{
-					size_t ind = Flag[ic][jc][kc][m];
-					if (/*Lp[ind]->fixed ||*/ ind<6)
-					{
-						flagtmp.push_back(ind);
-					}
+					p0->crossing[d] = true;
+					p0->crossingFlag = true;
 				}
-				Flag[ic][jc][kc] = flagtmp;
+			}
+			else
+			{
+				if (lower)	Lc.push_back({2*d, p});
+				if (upper)	Lc.push_back({2*d+1, p});
 			}
 		}
 	}
-	// #pragma omp parallel for schedule(static) num_threads(Nproc)
-	for (size_t p=6; p<Lp.size(); ++p)
-	{
-		DEM_PARTICLE* p0 = Lp[p];
-		/*if (!p0->fixed)	*/UpdateFlag(p0);
-	}
 }
 
 inline void DEM::Contact(bool writeFc, int n)
@@ -1005,30 +1223,13 @@ inline void DEM::Contact(bool writeFc, int n)
     {
     	unordered_map<size_t, Vector3d> fmap;
     	unordered_map<size_t, Vector3d> rmap;
-    	// #pragma omp parallel for schedule(static) num_threads(Nproc)
-		for (size_t l=0; l<Lc.size(); ++l)
-		{
-			int i = Lc[l][0];
-			int j = Lc[l][1];
-			// if (i==2)
-			// {
-			// 	cout << "i= " << i << " j= " << j << endl;
-			// 	// abort();
-			// }
-			// cout << "i= " << i << " j= " << j << endl;
-			// abort();
-			bool contacted = false;
-			Vector3d xi (0.,0.,0.);
-			Vector3d xir (0.,0.,0.);
-			Contact2P(Lp[i], Lp[j], xi, xir, contacted);
-			if (contacted)
-			{
-				fmap[Key(i,j)] = xi;
-				rmap[Key(i,j)] = xir;
-			}
-		}
+    	unordered_map<size_t, Vector3d> smap;
+    	if 		(CMID==0)				ContactList<0,0>(fmap, rmap, smap);
+    	else if (CMID==1 && DMID==0)	ContactList<1,0>(fmap, rmap, smap);
+    	else							ContactList<1,1>(fmap, rmap, smap);
 		FMap = fmap;
 		RMap = rmap;
+		SMap.swap(smap);
     }
     if (writeFc)	WriteContactForceFileH5(n);
 	// Lc.clear();
@@ -1037,32 +1238,41 @@ inline void DEM::Contact(bool writeFc, int n)
 inline void DEM::Solve(int tt, int ts, double dt, bool writefile)
 {
 	Dt = dt;
-	for (int t=0; t<tt; ++t)
+	int t0 = Step;
+	auto t_check = std::chrono::steady_clock::now();
+	for (int t=t0; t<tt; ++t)
 	{
-		bool show = false;
-		if (t%100==0)	show = true;
+		Step = t;
+		if (CheckpointInterval>0. && t>t0 && std::chrono::duration<double>(std::chrono::steady_clock::now()-t_check).count()>CheckpointInterval)
+		{
+			WriteCheckpoint("DEM_Checkpoint.bin");
+			t_check = std::chrono::steady_clock::now();
+		}
 		if (t%ts == 0)
 		{
 			cout << "Time Step ============ " << t << endl;
 			if (writefile /*&& t>4000*/)	WriteFileH5(t);
 		}
+		// the effect of sorting shows in the FindContact and Contact phases of the profile
+		if (SortInterval>0 && t>0 && t%SortInterval==0)
+		{
+			PROFILE_SCOPE("DEM::SortParticles");
+			SortParticles();
+		}
 
-		if (show)	cout << "Time Step ============ " << t << endl;
-		clock_t t_start = std::clock();
-		FindContact();
-		Lc.push_back({6,7});
-		// bool firstStep = false;
-		// if (t==0)	firstStep = true;
-		// FindContactBasedOnNode(firstStep);
-		clock_t t_end = std::clock();
-		if (show)	cout << "FindContact time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		t_start = std::clock();
-		Contact(false, 0);
-		int nc = Lc.size();
-		Lc.clear();
-		t_end = std::clock();
-		if (show)   cout << "nc= " << nc << endl;
-		if (show)	cout << "Contact time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
+		{
+			PROFILE_SCOPE("DEM::FindContact");
+			FindContact();
+			Lc.push_back({6,7});
+			// bool firstStep = false;
+			// if (t==0)	firstStep = true;
+			// FindContactBasedOnNode(firstStep);
+		}
+		{
+			PROFILE_SCOPE("DEM::Contact");
+			Contact(false, 0);
+			Lc.clear();
+		}
 		if (t==0)
 		{
 			for (size_t p=0; p<Lp.size(); ++p)
@@ -1070,8 +1280,15 @@ inline void DEM::Solve(int tt, int ts, double dt, bool writefile)
 				Lp[p]->Avb = (Lp[p]->Fh + Lp[p]->Fc + Lp[p]->Fex)/Lp[p]->M + Lp[p]->G;
 				Lp[p]->Awb = Lp[p]->I.asDiagonal().inverse()*((Lp[p]->Th + Lp[p]->Tc + Lp[p]->Tex));
 			}
+			for (size_t g=0; g<Lg.size(); ++g)
+			{
+				DEM_PARTICLE* g0 = Lg[g];
+				if (g0->Lo.size()!=g0->Lp.size())	SetClump(g0);
+				ClumpForce(g0);
+				g0->Avb = (g0->Fh + g0->Fc + g0->Fex)/g0->M + g0->G;
+				g0->Awb = g0->I.asDiagonal().inverse()*((g0->Th + g0->Tc + g0->Tex));
+			}
 		}
-		t_start = std::clock();
 
 		// double ta = 1e5;
 		// // Vector3d vtop (0.008*sin(t/ta), 0., 0.);
@@ -1106,27 +1323,280 @@ inline void DEM::Solve(int tt, int ts, double dt, bool writefile)
 		// 	}
 		// }
 
-		Move();
-		t_end = std::clock();
-		if (show)	cout << "Move time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		t_start = std::clock();
-		// WriteFileParticleInfo(t);
+		{
+			PROFILE_SCOPE("DEM::Move");
+			Move();
+		}
+		{
+			PROFILE_SCOPE("DEM::ZeroForceTorque");
+			if (ProbeInterval>0 && t%ProbeInterval==0)	WriteFileParticleInfo(t+1);		// state at the end of step t
+			ZeroForceTorque(true, true);
+		}
+	}
+	Step = 0;
+	Probe.Flush();
+	PROFILE_WRITE("DEM_Profile");
+}
+
+inline void DEM::RecordContactDt(DEM_PARTICLE* pi, DEM_PARTICLE* pj, double kn)
+{
+	if (kn<=0.)	return;
+	double me = EffectiveValue(pi->M, pj->M);
+	if (pi->ID<6)	me = pj->M;						// For collision with wall
+	double dtc = sqrt(me/kn);
+	if (dtc<MinContactDt)
+	{
+		#pragma omp critical
+		{
+			MinContactDt = min(MinContactDt, dtc);
+		}
+	}
+}
+
+inline void DEM::OverlapInLc(vector<double>& ov)
+{
+	ov.assign(Lc.size(), 0.);
+	#pragma omp parallel for schedule(static) num_threads(Nproc)
+	for (size_t l=0; l<Lc.size(); ++l)
+	{
+		DEM_PARTICLE* pi = Lp[Lc[l][0]];
+		DEM_PARTICLE* pj = Lp[Lc[l][1]];
+		if (pj->Type!=1 && pj->Type!=2)	continue;
+		double delta = 0.;
+		double r = pj->R;
+		if (pi->ID<6)
+		{
+			int axis = pi->ID/2;
+			int dirc = pi->ID-2*axis;
+			delta = pj->R-fabs(pj->X(axis)-dirc*DomSize[axis]);
+		}
+		else if (pi->Type==pj->Type)
+		{
+			Vector3d n = pi->X-pj->X;
+			MinimumImage(n);
+			delta = pi->R+pj->R-n.norm();
+			r = min(pi->R, pj->R);
+		}
+		ov[l] = delta/r;
+	}
+}
+
+inline void DEM::SaveState(DEM_PARTICLE* p0, DEM_STATE& st)
+{
+	st.X 	= p0->X;
+	st.V 	= p0->V;
+	st.W 	= p0->W;
+	st.Avb 	= p0->Avb;
+	st.Awb 	= p0->Awb;
+	st.Fh 	= p0->Fh;
+	st.Th 	= p0->Th;
+	st.Q 	= p0->Q;
+}
+
+inline void DEM::RestoreState(DEM_PARTICLE* p0, DEM_STATE& st)
+{
+	p0->X 	= st.X;
+	p0->V 	= st.V;
+	p0->W 	= st.W;
+	p0->Avb = st.Avb;
+	p0->Awb = st.Awb;
+	p0->Fh 	= st.Fh;
+	p0->Th 	= st.Th;
+	p0->Q 	= st.Q;
+	p0->Qf 	= p0->Q0*p0->Q;
+	p0->Qfi = p0->Qf.inverse();
+	p0->PValid = false;
+	p0->Fc.setZero();
+	p0->Tc.setZero();
+	p0->UpdateBox(D);
+}
+
+// Adaptive time stepping
+// The macro step is limited by DtMax and by the fastest particle (CoefDtMove*Rmin/Vmax), the (sub) step by the stiffest contact
+// of the previous step (CoefDtContact*sqrt(me/kn)). Contacts are searched with a skin covering the motion of the whole macro step.
+// With MultiRate only particles in candidate pairs take sub-steps, free particles take the macro step at once.
+// A step in which a sub-step increases an overlap by more than OverlapTol*radius is rejected and repeated with a smaller sub-step.
+// Step counts and rejections are written to DEM_TimeStep.res every ts.
+inline void DEM::SolveAdaptive(double tt, double ts, double dt0, bool writefile)
+{
+	bool multi = MultiRate;
+	if (multi && Lg.size()>0)
+	{
+		cout << "\033[1;33mWarning: multi-rate sub-stepping does not support groups, single rate is used.\033[0m\n";
+		multi = false;
+	}
+	TrackDt = true;
+	double time = 0.;
+	double dt = dt0;												// macro step
+	double dtc = dt0;												// step limited by contact stiffness
+	bool first = true;
+	size_t nout = 0;
+	size_t nmacro = 0, nsub = 0, nrej = 0;							// counts since last output
+	size_t tmacro = 0, tsub = 0, trej = 0;							// total counts
+	vector<DEM_STATE> st, stg;											// states of particles and groups
+	vector<size_t> la, lf;											// lists of active and free particles
+	vector<bool> active;
+	vector<double> ov0, ov1;										// overlaps of pairs in Lc before and after a sub-step
+	unordered_map<size_t, Vector3d> fmap0, rmap0;
+
+	ofstream log("DEM_TimeStep.res", ios_base::out);
+	log << "\"Time\"     \"Dt\"     \"MacroSteps\"     \"SubSteps\"     \"Rejections\"     \"Active\"\n";
+	while (time<tt)
+	{
+		if (time>=nout*ts)
+		{
+			cout << "Time ============ " << time << " dt= " << dt << " macro steps= " << nmacro << " sub steps= " << nsub << " rejections= " << nrej << endl;
+			log << setprecision(9) << fixed << time << "     " << dt << "     " << nmacro << "     " << nsub << "     " << nrej << "     " << la.size() << "\n";
+			if (writefile)	WriteFileH5(nout);
+			nmacro = 0;
+			nsub = 0;
+			nrej = 0;
+			nout++;
+		}
+		// Time step controller
+		double vmax = 0.;
+		double amax = 0.;
+		double rmin = 1.0e300;
+		for (size_t p=6; p<Lp.size(); ++p)
+		{
+			DEM_PARTICLE* p0 = Lp[p];
+			vmax = max(vmax, p0->V.norm());
+			if (p0->M>0.)	amax = max(amax, ((p0->Fh+p0->Fex)/p0->M+p0->G).norm());
+			rmin = min(rmin, p0->Rb);
+		}
+		double dtm = DtMax;
+		if (vmax>0.)	dtm = min(dtm, CoefDtMove*rmin/vmax);
+		dt = min(dtm, 2.*dt);
+		if (!multi)		dt = min(dt, dtc);
+		dt = min(dt, max(nout*ts-time, DtMin));
+		dt = max(dt, DtMin);
+		double dts = min(dt, dtc);
+		size_t ns = (size_t) ceil(dt/dts-1.0e-9);
+
+		st.resize(Lp.size());
+		stg.resize(Lg.size());
+		for (size_t p=6; p<Lp.size(); ++p)	SaveState(Lp[p], st[p]);
+		for (size_t g=0; g<Lg.size(); ++g)	SaveState(Lg[g], stg[g]);
+		fmap0 = FMap;
+		rmap0 = RMap;
+		bool rejected = true;
+		while (rejected)
+		{
+			dts = dt/ns;
+			MinContactDt = 1.0e300;
+			Hgrid.Skin = 2.*(vmax*dt+0.5*amax*dt*dt);
+			Lc.clear();
+			FindContact();
+			// particles in candidate pairs may contact during this macro step
+			active.assign(Lp.size(), !multi);
+			for (size_t l=0; l<Lc.size(); ++l)
+			{
+				active[Lc[l][0]] = true;
+				active[Lc[l][1]] = true;
+			}
+			la.clear();
+			lf.clear();
+			for (size_t p=6; p<Lp.size(); ++p)
+			{
+				if (active[p])	la.push_back(p);
+				else			lf.push_back(p);
+			}
+			OverlapInLc(ov0);
+			double dov = 0.;											// max increase of overlap/radius in one sub-step
+			Dt = dts;
+			for (size_t s=0; s<ns; ++s)
+			{
+				Contact(false, 0);
+				if (first)
+				{
+					for (size_t p=0; p<Lp.size(); ++p)
+					{
+						Lp[p]->Avb = (Lp[p]->Fh + Lp[p]->Fc + Lp[p]->Fex)/Lp[p]->M + Lp[p]->G;
+						Lp[p]->Awb = Lp[p]->I.asDiagonal().inverse()*((Lp[p]->Th + Lp[p]->Tc + Lp[p]->Tex));
+					}
+					for (size_t g=0; g<Lg.size(); ++g)
+					{
+						DEM_PARTICLE* g0 = Lg[g];
+						if (g0->Lo.size()!=g0->Lp.size())	SetClump(g0);
+						ClumpForce(g0);
+						g0->Avb = (g0->Fh + g0->Fc + g0->Fex)/g0->M + g0->G;
+						g0->Awb = g0->I.asDiagonal().inverse()*((g0->Th + g0->Tc + g0->Tex));
+					}
+				}
+				if (multi)
+				{
+					#pragma omp parallel for schedule(static) num_threads(Nproc)
+					for (size_t a=0; a<la.size(); ++a)
+					{
+						MoveParticle(Lp[la[a]]);
+						Lp[la[a]]->ZeroForceTorque(false, true);
+					}
+				}
+				else
+				{
+					Move();
+					ZeroForceTorque(false, true);
+				}
+				OverlapInLc(ov1);
+				for (size_t l=0; l<Lc.size(); ++l)	dov = max(dov, ov1[l]-max(ov0[l], 0.));
+				ov0.swap(ov1);
+			}
+			Dt = dt;
+			#pragma omp parallel for schedule(static) num_threads(Nproc)
+			for (size_t a=0; a<lf.size(); ++a)	MoveParticle(Lp[lf[a]]);
+			// reject the step if a sub-step produced a too large overlap
+			if (dov>OverlapTol && dts>DtMin)
+			{
+				for (size_t p=6; p<Lp.size(); ++p)	RestoreState(Lp[p], st[p]);
+				for (size_t g=0; g<Lg.size(); ++g)	RestoreState(Lg[g], stg[g]);
+				FMap = fmap0;
+				RMap = rmap0;
+				dtc = max(DtMin, min(0.5*dts, CoefDtContact*MinContactDt));
+				if (!multi)	dt = dtc;
+				ns = (size_t) ceil(dt/dtc-1.0e-9);
+				nrej++;
+				trej++;
+				continue;
+			}
+			rejected = false;
+			first = false;
+		}
+		if (ProbeInterval>0 && tmacro%ProbeInterval==0)	Probe.Record(time+dt, Lp, Nproc);
 		ZeroForceTorque(true, true);
-		t_end = std::clock();
-		if (show)	cout << "ZeroForceTorque time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
+		dtc = DtMax;
+		if (MinContactDt<1.0e300)	dtc = max(DtMin, CoefDtContact*MinContactDt);
+		time += dt;
+		nmacro++;
+		tmacro++;
+		nsub += ns;
+		tsub += ns;
 	}
+	Lc.clear();
+	Hgrid.Skin = 0.;
+	TrackDt = false;
+	Dt = dt;
+	Probe.Flush();
+	cout << "Adaptive time stepping finished: macro steps= " << tmacro << " sub steps= " << tsub << " rejections= " << trej << endl;
+	log << setprecision(9) << fixed << time << "     " << dt << "     " << nmacro << "     " << nsub << "     " << nrej << "     " << la.size() << "\n";
 }
 
 void DEM::DeleteParticles()
 {
 	vector <DEM_PARTICLE*>	Lpt;
 	Lpt.resize(0);
+	vector<size_t> newID (Lp.size());
 
 	for (size_t p=0; p<Lp.size(); ++p)
 	{
-		if (!Lp[p]->removed)	Lpt.push_back(Lp[p]);
+		newID[p] = DEM_PROBE::Removed;
+		if (!Lp[p]->removed)
+		{
+			newID[p] = Lpt.size();
+			Lpt.push_back(Lp[p]);
+		}
 	}
 	Lp = Lpt;
+	Probe.Remap(newID);
 
 	for (size_t p=0; p<Lp.size(); ++p)
 	{
@@ -1134,65 +1604,317 @@ void DEM::DeleteParticles()
 	}
 }
 
-void DEM::LoadDEMFromH5( string fname, double scale, double rhos)
+// Reorder particles (except the 6 walls) along a Morton curve of the contact mesh.
+// Particles are copied into freshly allocated objects in the new order so that neighbours in space are also neighbours in memory.
+// IDs, group members and the tangential histories in FMap and RMap are remapped to the new order.
+inline void DEM::SortParticles()
+{
+	size_t np = Lp.size()-6;
+	vector< pair<size_t, size_t> > lk (np);						// Morton key and old ID
+	#pragma omp parallel for schedule(static) num_threads(Nproc)
+	for (size_t p=6; p<Lp.size(); ++p)
+	{
+		size_t ind[3] = {0, 0, 0};
+		for (size_t d=0; d<D; ++d)	ind[d] = (size_t) max(0, (int) Lp[p]->X(d));
+		lk[p-6] = make_pair(MortonKey(ind[0], ind[1], ind[2]), p);
+	}
+	stable_sort(lk.begin(), lk.end());
+
+	vector<size_t> newID (Lp.size());
+	for (size_t p=0; p<6; ++p)	newID[p] = p;
+	vector <DEM_PARTICLE*> Lpt (Lp.size());
+	for (size_t p=0; p<6; ++p)	Lpt[p] = Lp[p];
+	for (size_t n=0; n<np; ++n)
+	{
+		size_t p = lk[n].second;
+		newID[p] = n+6;
+		Lpt[n+6] = new DEM_PARTICLE(*Lp[p]);
+		Lpt[n+6]->ID = n+6;
+		delete Lp[p];
+	}
+	Lp = Lpt;
+
+	for (size_t g=0; g<Lg.size(); ++g)
+	for (size_t l=0; l<Lg[g]->Lp.size(); ++l)
+	{
+		Lg[g]->Lp[l] = newID[Lg[g]->Lp[l]];
+	}
+	Probe.Remap(newID);
+	// Contact pairs are always stored as (min ID, max ID), the tangential spring changes sign if the order of a pair is swapped
+	unordered_map<size_t, Vector3d> fmap;
+	unordered_map<size_t, Vector3d> rmap;
+	for (auto it=FMap.begin(); it!=FMap.end(); ++it)
+	{
+		size_t i, j;
+		InverseKey(it->first, i, j);
+		size_t ni = newID[i];
+		size_t nj = newID[j];
+		if (ni<nj)	fmap[Key(ni,nj)] = it->second;
+		else		fmap[Key(nj,ni)] = -it->second;
+	}
+	for (auto it=RMap.begin(); it!=RMap.end(); ++it)
+	{
+		size_t i, j;
+		InverseKey(it->first, i, j);
+		size_t ni = newID[i];
+		size_t nj = newID[j];
+		rmap[Key(min(ni,nj),max(ni,nj))] = it->second;
+	}
+	FMap = fmap;
+	RMap = rmap;
+	CMap.clear();
+	SMap.clear();
+}
+
+// Schema of the particle datasets, shared by WriteFileH5, PACKING::WriteH5 and LoadDEMFromH5.
+// All datasets are arrays of doubles with one entry (or 3 or 4 components) per particle, walls (Lp[0..5]) are not stored.
+// Vector datasets are either 1D (3N) or 2D (N x 3) arrays.
+// 	Position 		3N	required
+// 	Radius 			N	required
+// 	Rho 			N	density, rhos is used if missing
+// 	Tag 			N	0 if missing
+// 	Type 			N	shape type of DEM_PARTICLE (1 sphere, 2 disk2d), spheres (disks in 2D) if missing
+// 	Velocity 		3N	zero if missing
+// 	AngularVelocity	3N	under lab frame, zero if missing
+// 	Orientation 	4N	quaternion Q (w, x, y, z), identity if missing
+// Number of values in a 1D or 2D dataset, other ranks are rejected
+inline size_t H5DatasetSize(DataSpace& fspace, string name)
+{
+	int rank = fspace.getSimpleExtentNdims();
+	if (rank<1 || rank>2)
+	{
+		cout << "\033[1;31mError: Dataset " << name << " has rank " << rank << " but 1 or 2 is expected.\033[0m\n";
+		exit(0);
+	}
+	hsize_t dims[2] = {1, 1};
+	fspace.getSimpleExtentDims(dims, NULL);
+	return dims[0]*dims[1];
+}
+
+inline bool ReadH5Dataset(H5File& file, string name, size_t ncomp, size_t np, vector<double>& data)
+{
+	if (H5Lexists(file.getId(), name.c_str(), H5P_DEFAULT)<=0)	return false;
+	DataSet dataset = file.openDataSet(name);
+	DataSpace fspace = dataset.getSpace();
+	size_t n = H5DatasetSize(fspace, name);
+	hsize_t dims[2] = {n, 1};
+	fspace.getSimpleExtentDims(dims, NULL);
+	int rank = fspace.getSimpleExtentNdims();
+	if (n!=ncomp*np || (rank==2 && dims[1]!=ncomp))
+	{
+		cout << "\033[1;31mError: Size of dataset " << name << " is " << n << " but " << ncomp*np << " (" << np << " x " << ncomp << ") is expected.\033[0m\n";
+		exit(0);
+	}
+	data.resize(ncomp*np);
+	// read by hyperslabs to keep HDF5 buffers small for large files
+	size_t nchunk = 1<<20;
+	for (size_t i0=0; i0<np; i0+=nchunk)
+	{
+		size_t nc = min(nchunk, np-i0);
+		hsize_t offset[2] = {ncomp*i0, 0};
+		hsize_t count[2] = {ncomp*nc, 1};
+		if (rank==2)
+		{
+			offset[0] = i0;
+			count[0] = nc;
+			count[1] = ncomp;
+		}
+		fspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+		hsize_t nm[1] = {ncomp*nc};
+		DataSpace mspace(1, nm);
+		dataset.read(data.data()+ncomp*i0, PredType::NATIVE_DOUBLE, mspace, fspace);
+	}
+	return true;
+}
+
+inline void DEM::LoadDEMFromH5( string fname, double scale, double rhos)
 {
 	cout << "========= Start loading DEM particles from " << fname << "==============" << endl;
-	H5std_string FILE_NAME( fname );
-	H5std_string DATASET_NAME_POS( "Position" );
-	H5File file_pos( FILE_NAME, H5F_ACC_RDONLY );
-	DataSet dataset_pos = file_pos.openDataSet( DATASET_NAME_POS );
-	DataSpace dataspace_pos = dataset_pos.getSpace();
-    hsize_t dims_pos[2];
-    dataspace_pos.getSimpleExtentDims( dims_pos, NULL);
-    hsize_t dimsm_pos = dims_pos[0];
-
-	H5std_string DATASET_NAME_R( "Radius" );
-	H5File file_r( FILE_NAME, H5F_ACC_RDONLY );
-	DataSet dataset_r = file_r.openDataSet( DATASET_NAME_R );
-	DataSpace dataspace_r = dataset_r.getSpace();
-    hsize_t dims_r[2];
-    dataspace_r.getSimpleExtentDims( dims_r, NULL);
-    hsize_t dimsm_r = dims_r[0];
-
-	// H5std_string DATASET_NAME_RHO( "Rho" );
-	// H5File file_rho( FILE_NAME, H5F_ACC_RDONLY );
-	// DataSet dataset_rho = file_rho.openDataSet( DATASET_NAME_RHO );
-	// DataSpace dataspace_rho = dataset_r.getSpace();
- //    hsize_t dims_rho[2];
- //    dataspace_rho.getSimpleExtentDims( dims_rho, NULL);
- //    hsize_t dimsm_rho = dims_rho[0];
-
-	H5std_string DATASET_NAME_TAG( "Tag" );
-	H5File file_tag( FILE_NAME, H5F_ACC_RDONLY );
-	DataSet dataset_tag = file_tag.openDataSet( DATASET_NAME_TAG );
-	DataSpace dataspace_tag = dataset_tag.getSpace();
-    hsize_t dims_tag[2];
-    dataspace_tag.getSimpleExtentDims( dims_tag, NULL);
-    hsize_t dimsm_tag = dims_tag[0];
-
-    double data_pos[dimsm_pos];
-    dataset_pos.read( data_pos, PredType::NATIVE_DOUBLE, dataspace_pos, dataspace_pos );
-
-    double data_r[dimsm_r];
-    dataset_r.read( data_r, PredType::NATIVE_DOUBLE, dataspace_r, dataspace_r );
-
-    // double data_rho[dimsm_rho];
-    // dataset_rho.read( data_rho, PredType::NATIVE_DOUBLE, dataspace_rho, dataspace_rho );
-
-    double data_tag[dimsm_tag];
-    dataset_tag.read( data_tag, PredType::NATIVE_DOUBLE, dataspace_tag, dataspace_tag );
-
-    int np = dimsm_pos/3;
-    for (int i=6; i<np; ++i)
-    {
-    	Vector3d pos (scale*data_pos[3*i], scale*data_pos[3*i+1], scale*data_pos[3*i+2]);
-    	double r = scale*data_r[i];
-    	int tag = (int) data_tag[i];
-    	// double rho = data_rho[i];
-    	double rho = rhos;
-    	AddSphere(tag, r, pos, rho);
-    }
-    cout << "========= Loaded "<< Lp.size()-6<< " DEM particles from " << fname << "==============" << endl;
+	auto t_start = std::chrono::steady_clock::now();
+	H5File file(fname, H5F_ACC_RDONLY);
+
+	vector<double> pos, r, rho, tag, type, vel, agv, ori;
+	if (H5Lexists(file.getId(), "Position", H5P_DEFAULT)<=0)
+	{
+		cout << "\033[1;31mError: Dataset Position is not found in " << fname << ".\033[0m\n";
+		exit(0);
+	}
+	DataSpace space_pos = file.openDataSet("Position").getSpace();
+	size_t np = H5DatasetSize(space_pos, "Position")/3;
+
+	ReadH5Dataset(file, "Position", 3, np, pos);
+	if (!ReadH5Dataset(file, "Radius", 1, np, r))
+	{
+		cout << "\033[1;31mError: Dataset Radius is not found in " << fname << ".\033[0m\n";
+		exit(0);
+	}
+	bool hasRho 	= ReadH5Dataset(file, "Rho", 1, np, rho);
+	bool hasTag 	= ReadH5Dataset(file, "Tag", 1, np, tag);
+	bool hasType 	= ReadH5Dataset(file, "Type", 1, np, type);
+	bool hasVel 	= ReadH5Dataset(file, "Velocity", 3, np, vel);
+	bool hasAgv 	= ReadH5Dataset(file, "AngularVelocity", 3, np, agv);
+	bool hasOri 	= ReadH5Dataset(file, "Orientation", 4, np, ori);
+	file.close();
+
+	size_t n0 = Lp.size();
+	Lp.resize(n0+np);
+	size_t nskip = 0;
+	#pragma omp parallel for schedule(static) num_threads(Nproc) reduction(+:nskip)
+	for (size_t i=0; i<np; ++i)
+	{
+		Vector3d x (scale*pos[3*i], scale*pos[3*i+1], scale*pos[3*i+2]);
+		DEM_PARTICLE* p0 = new DEM_PARTICLE(hasTag ? (int) tag[i] : 0, x, hasRho ? rho[i] : rhos);
+		p0->ID = n0+i;
+		int t = hasType ? (int) type[i] : (D==2 ? 2 : 1);
+		if 		(t==1)	p0->SetSphere(scale*r[i]);
+		else if (t==2)	p0->SetDisk2D(scale*r[i]);
+		else
+		{
+			// other shapes need their vertices, load them as spheres
+			p0->SetSphere(scale*r[i]);
+			nskip++;
+		}
+		if (hasOri)
+		{
+			p0->Q = Quaterniond(ori[4*i], ori[4*i+1], ori[4*i+2], ori[4*i+3]);
+			p0->Q.normalize();
+			p0->Qf = p0->Q0*p0->Q;
+			p0->Qfi = p0->Qf.inverse();
+			p0->PValid = false;
+		}
+		if (hasVel)	p0->V << scale*vel[3*i], scale*vel[3*i+1], scale*vel[3*i+2];
+		if (hasAgv)
+		{
+			Vector3d w (agv[3*i], agv[3*i+1], agv[3*i+2]);
+			p0->W = p0->Q.inverse()._transformVector(w);
+		}
+		Lp[n0+i] = p0;
+	}
+	if (nskip>0)	cout << "\033[1;33mWarning: " << nskip << " particles are not spheres or disks and are loaded as spheres.\033[0m\n";
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now()-t_start).count();
+	cout << "========= Loaded "<< np << " DEM particles from " << fname << " in " << t << " s ==============" << endl;
+}
+
+// Checkpoint of the full DEM state, Solve continues bit-exactly from Step after ReadCheckpoint.
+// The file is written to fname.tmp first and renamed, so an interrupted write keeps the previous checkpoint.
+inline void DEM::WriteCheckpoint(string fname)
+{
+	auto t_start = std::chrono::steady_clock::now();
+	string tname = fname+".tmp";
+	ofstream out(tname, ios_base::out | ios_base::binary);
+	if (!out)
+	{
+		cout << "\033[1;31mError: Cannot open " << tname << " for checkpoint.\033[0m\n";
+		exit(0);
+	}
+	vector<char> buf (1<<22);
+	out.rdbuf()->pubsetbuf(buf.data(), buf.size());
+
+	int version = 3;
+	out.write("DEMCHECK", 8);
+	WriteBin(out, version);
+	WriteBin(out, D);
+	WriteBin(out, DomSize);
+	WriteBin(out, CMID);
+	WriteBin(out, DMID);
+	WriteBin(out, Step);
+	WriteBin(out, Dt);
+	WriteBin(out, SortInterval);
+	WriteBin(out, Periodic);
+	WriteBin(out, Cr);
+	WriteBin(out, Beta);
+	WriteBin(out, RatioGnt);
+	WriteBin(out, RatioKnr);
+	WriteBin(out, RatioGnr);
+	WriteBin(out, Hn);
+	WriteBin(out, Viscosity);
+	WriteBin(out, Np);
+	WriteBin(out, Nf);
+	WriteBin(out, FsTable);
+	WriteBin(out, FdTable);
+	WriteBin(out, RsTable);
+	WriteBin(out, RdTable);
+
+	size_t np = Lp.size();
+	size_t ng = Lg.size();
+	WriteBin(out, np);
+	for (size_t p=0; p<np; ++p)	WriteParticle(out, Lp[p]);
+	WriteBin(out, ng);
+	for (size_t g=0; g<ng; ++g)	WriteParticle(out, Lg[g]);
+	WriteBin(out, FMap);
+	WriteBin(out, RMap);
+	WriteBin(out, SMap);
+	out.close();
+	if (!out || rename(tname.c_str(), fname.c_str())!=0)
+	{
+		cout << "\033[1;33mWarning: Checkpoint " << fname << " is not written.\033[0m\n";
+		return;
+	}
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now()-t_start).count();
+	cout << "Checkpoint of step " << Step << " is written to " << fname << " in " << t << " s" << endl;
+}
+
+inline void DEM::ReadCheckpoint(string fname)
+{
+	ifstream in(fname, ios_base::in | ios_base::binary);
+	char magic[8];
+	in.read(magic, 8);
+	int version = 0;
+	ReadBin(in, version);
+	if (!in || strncmp(magic, "DEMCHECK", 8)!=0 || version!=3)
+	{
+		cout << "\033[1;31mError: " << fname << " is not a DEM checkpoint.\033[0m\n";
+		exit(0);
+	}
+	size_t d;
+	int domSize[3], cmid, dmid;
+	ReadBin(in, d);
+	ReadBin(in, domSize);
+	ReadBin(in, cmid);
+	ReadBin(in, dmid);
+	if (d!=D || domSize[0]!=DomSize[0] || domSize[1]!=DomSize[1] || domSize[2]!=DomSize[2] || cmid!=CMID || dmid!=DMID)
+	{
+		cout << "\033[1;31mError: Domain or contact model of " << fname << " is different from this DEM.\033[0m\n";
+		exit(0);
+	}
+	ReadBin(in, Step);
+	ReadBin(in, Dt);
+	ReadBin(in, SortInterval);
+	ReadBin(in, Periodic);
+	ReadBin(in, Cr);
+	ReadBin(in, Beta);
+	ReadBin(in, RatioGnt);
+	ReadBin(in, RatioKnr);
+	ReadBin(in, RatioGnr);
+	ReadBin(in, Hn);
+	ReadBin(in, Viscosity);
+	ReadBin(in, Np);
+	ReadBin(in, Nf);
+	ReadBin(in, FsTable);
+	ReadBin(in, FdTable);
+	ReadBin(in, RsTable);
+	ReadBin(in, RdTable);
+
+	for (size_t p=0; p<Lp.size(); ++p)	delete Lp[p];
+	for (size_t g=0; g<Lg.size(); ++g)	delete Lg[g];
+	size_t np, ng;
+	ReadBin(in, np);
+	Lp.resize(np);
+	for (size_t p=0; p<np; ++p)	Lp[p] = ReadParticle(in);
+	ReadBin(in, ng);
+	Lg.resize(ng);
+	for (size_t g=0; g<ng; ++g)	Lg[g] = ReadParticle(in);
+	ReadBin(in, FMap);
+	ReadBin(in, RMap);
+	ReadBin(in, SMap);
+	if (!in)
+	{
+		cout << "\033[1;31mError: " << fname << " is incomplete.\033[0m\n";
+		exit(0);
+	}
+	Lc.clear();
+	CMap.clear();
+	cout << "Restart from step " << Step << " with " << np << " particles and " << ng << " groups" << endl;
 }
 
 // inline void DEM::WriteFileH5(int n)
@@ -1428,6 +2150,7 @@ inline void DEM::WriteFileH5(int n)
 
 	for (size_t i=6; i<Lp.size(); ++i)
 	{
+		Lp[i]->UpdateP();
 		n_points += Lp[i]->P.size();
 		n_faces  += Lp[i]->Faces.size();
 		n_fe 	 += Lp[i]->Nfe;
@@ -1446,6 +2169,8 @@ inline void DEM::WriteFileH5(int n)
 
 	DataSpace	*space_scalar = new DataSpace(rank_scalar, dims_scalar);
 	DataSpace	*space_vector = new DataSpace(rank_vector, dims_vector);
+	hsize_t	dims_quat[1] = {4*npar};
+	DataSpace	*space_quat   = new DataSpace(1, dims_quat);
 
 	DataSpace	*space_points = new DataSpace(rank_points, dims_points);
 	DataSpace	*space_faces  = new DataSpace(rank_faces , dims_faces );
@@ -1454,6 +2179,8 @@ inline void DEM::WriteFileH5(int n)
 	double* r_h5 	= new double[  npar];
 	double* rho_h5 	= new double[  npar];
 	double* tag_h5 	= new double[  npar];
+	double* type_h5	= new double[  npar];
+	double* ori_h5 	= new double[4*npar];
 	double* pos_h5 	= new double[3*npar];
 	double* vel_h5 	= new double[3*npar];
 	double* agv_h5	= new double[3*npar];
@@ -1476,6 +2203,11 @@ inline void DEM::WriteFileH5(int n)
         r_h5  [  i  ] 	= Lp[ind]->R;
         rho_h5[  i  ] 	= Lp[ind]->Rho;
         tag_h5[  i  ] 	= Lp[ind]->Tag;
+        type_h5[  i  ] 	= Lp[ind]->Type;
+		ori_h5[4*i  ] 	= Lp[ind]->Q.w();
+		ori_h5[4*i+1] 	= Lp[ind]->Q.x();
+		ori_h5[4*i+2] 	= Lp[ind]->Q.y();
+		ori_h5[4*i+3] 	= Lp[ind]->Q.z();
 		pos_h5[3*i  ] 	= Lp[ind]->X(0);
 		pos_h5[3*i+1] 	= Lp[ind]->X(1);
 		pos_h5[3*i+2] 	= Lp[ind]->X(2);
@@ -1516,6 +2248,8 @@ inline void DEM::WriteFileH5(int n)
 	DataSet	*dataset_r 		= new DataSet(file.createDataSet("Radius", PredType::NATIVE_DOUBLE, *space_scalar));
 	DataSet	*dataset_rho	= new DataSet(file.createDataSet("Rho", PredType::NATIVE_DOUBLE, *space_scalar));
 	DataSet	*dataset_tag	= new DataSet(file.createDataSet("Tag", PredType::NATIVE_DOUBLE, *space_scalar));
+	DataSet	*dataset_type	= new DataSet(file.createDataSet("Type", PredType::NATIVE_DOUBLE, *space_scalar));
+	DataSet	*dataset_ori	= new DataSet(file.createDataSet("Orientation", PredType::NATIVE_DOUBLE, *space_quat));
     DataSet	*dataset_pos	= new DataSet(file.createDataSet("Position", PredType::NATIVE_DOUBLE, *space_vector));
     DataSet	*dataset_vel	= new DataSet(file.createDataSet("Velocity", PredType::NATIVE_DOUBLE, *space_vector));
     DataSet	*dataset_agv	= new DataSet(file.createDataSet("AngularVelocity", PredType::NATIVE_DOUBLE, *space_vector));
@@ -1529,6 +2263,8 @@ inline void DEM::WriteFileH5(int n)
 	dataset_r->write(r_h5, PredType::NATIVE_DOUBLE);
 	dataset_rho->write(rho_h5, PredType::NATIVE_DOUBLE);
 	dataset_tag->write(tag_h5, PredType::NATIVE_DOUBLE);
+	dataset_type->write(type_h5, PredType::NATIVE_DOUBLE);
+	dataset_ori->write(ori_h5, PredType::NATIVE_DOUBLE);
 	dataset_pos->write(pos_h5, PredType::NATIVE_DOUBLE);
 	dataset_vel->write(vel_h5, PredType::NATIVE_DOUBLE);
 	dataset_agv->write(agv_h5, PredType::NATIVE_DOUBLE);
@@ -1541,9 +2277,12 @@ inline void DEM::WriteFileH5(int n)
 
 	delete space_scalar;
 	delete space_vector;
+	delete space_quat;
 	delete dataset_r;
 	delete dataset_rho;
 	delete dataset_tag;
+	delete dataset_type;
+	delete dataset_ori;
 	delete dataset_pos;
 	delete dataset_vel;
 	delete dataset_agv;
@@ -1552,17 +2291,19 @@ inline void DEM::WriteFileH5(int n)
 	delete dataset_fac;
 	delete dataset_fv;
 	delete dataset_ftag;
-	delete r_h5;
-	delete rho_h5;
-	delete tag_h5;
-	delete pos_h5;
-	delete vel_h5;
-	delete agv_h5;
-	delete fh_h5;
-	delete poi_h5;
-	delete fac_h5;
-	delete fv_h5;
-	delete ftag_h5;
+	delete[] r_h5;
+	delete[] rho_h5;
+	delete[] tag_h5;
+	delete[] type_h5;
+	delete[] ori_h5;
+	delete[] pos_h5;
+	delete[] vel_h5;
+	delete[] agv_h5;
+	delete[] fh_h5;
+	delete[] poi_h5;
+	delete[] fac_h5;
+	delete[] fv_h5;
+	delete[] ftag_h5;
 
 	file.close();
 
@@ -1695,22 +2436,27 @@ inline void DEM::WriteContactForceFileH5(int n)
 	file.close();
 }
 
+inline void DEM::AddProbe(size_t id)
+{
+	if (id>=Lp.size())
+	{
+		cout << "\033[1;31mError: Probe particle " << id << " does not exist.\033[0m\n";
+		exit(0);
+	}
+	Probe.Add(id);
+}
+
+inline void DEM::AddProbeTag(int tag)
+{
+	for (size_t p=6; p<Lp.size(); ++p)
+	{
+		if (Lp[p]->Tag==tag)	Probe.Add(p);
+	}
+}
+
 inline void DEM::WriteFileParticleInfo(int n)
 {
-    // #pragma omp parallel for schedule(static) num_threads(Nproc)
-    for (size_t p=6; p<Lp.size(); ++p)
-    {
-    	if (p==1139 || p==2162)
-    	{
-	        ostringstream info;
-	        info << "particleInfo_" << p << ".res";
-	        ofstream log(info.str().c_str(), ios_base::out | ios_base::app);
-	        if (n==0)   log << "\"Time\"     \"X\"     \"Y\"     \"Z\"     \"U\"     \"V\"     \"W\"      \"Wx\"     \"Wy\"     \"Wz\"      \"Fhx\"     \"Fhy\"     \"Fhz\"      \"Thx\"     \"Thy\"     \"Thz\"     \"Fcx\"     \"Fcy\"     \"Fcz\"      \"Tcx\"     \"Tcy\"     \"Tcz\"\n";
-	        else;
-	        log << setprecision(9) << fixed << (double)n << "     " << Lp[p]->X(0) << "     " << Lp[p]->X(1) << "     " << Lp[p]->X(2) << "     " << Lp[p]->V(0) << "     " << Lp[p]->V(1) << "     " << Lp[p]->V(2) << "     " << Lp[p]->W(0) << "     " << Lp[p]->W(1) << "     " << Lp[p]->W(2) << "     " << Lp[p]->Fh(0) << "     " << Lp[p]->Fh(1) << "     " << Lp[p]->Fh(2)<< "     " << Lp[p]->Th(0) << "     " << Lp[p]->Th(1) << "     " << Lp[p]->Th(2) << "     " << Lp[p]->Fc(0) << "     " << Lp[p]->Fc(1) << "     " << Lp[p]->Fc(2)<< "     " << Lp[p]->Tc(0) << "     " << Lp[p]->Tc(1)<< "     " << Lp[p]->Tc(2) << "\n";
-
-    	}
-    }
+	Probe.Record(n*Dt, Lp, Nproc);
 }
 
 // inline void DEM::WriteFileParticleInfo(int n)
@@ -39,6 +39,8 @@ public:
 	void Set2DPolynomialParticle(VectorXd& coef);			// Change DEM_PARTICLE to 2D Polynomial Particle
 	void SetCuboid(double lx, double ly, double lz);		// Change DEM_PARTICLE to Cuboid
 	void SetTetrahedron(vector<Vector3d> ver);
+	void SetAdjacency();									// Build vertex adjacency from Edges and Faces, call it after the shape is set
+	void UpdateP();											// Transform P0 to the lab frame positions P if they are out of date
 	void UpdateCoef();
 	// void DistanceToSurface(Vector3d& x);
 
@@ -51,6 +53,7 @@ public:
 
 	double      				Rho;				    	// density
     double      				R;							// radius of sphere
+    double      				Rb;							// radius of bounding sphere, used for broad phase contact detection
 	double      				M;					        // mass
 	double 						Vol;						// volume
 	double      				Kn;					        // normal stiffness
@@ -68,9 +71,10 @@ public:
 
 	vector<Vector3d>			P0;				        	// list of point positions at init
 	vector<Vector3d>			Ps;				        	// list of point positions at init under spherical coordinate
-	vector<Vector3d>			P;				        	// list of point positions at current time step
+	vector<Vector3d>			P;				        	// list of point positions at current time step, call UpdateP before use
 	vector<Vector2i>			Edges;				        // list of edges
 	vector<VectorXi>			Faces;				        // list of faces
+	vector< vector<size_t> >	Adj;				        // list of adjacent vertices of each vertex, used by hill climbing support mapping
 	
 	Vector3d					X0;				            // init position
 	Vector3d					X;				            // position
@@ -97,6 +101,7 @@ public:
 	bool				        fixV;				    	// flag for fixed translational velocity
 	bool        				fixW;				    	// flag for fixed angular velocity
 	bool 						fixed;						// flag for fixed particle with zero velocity
+	bool 						PValid;						// flag for P being up to date with X and Qf
 	bool 						crossing[3];
 	bool 						crossingFlag;
 	bool 						constrained[3];			
@@ -113,7 +118,8 @@ public:
     vector< size_t >			Lp;							// List of particles ID which belong to this group
     vector< double >			Ld;							// List of distance between boundary nodes and particle surFaces for NEBB
     vector< Vector3d >			Li;							// List of position of interpation points for boundary nodes
-    vector< Vector3d >			Xmir;				        // mirror positions
+    vector< Vector3d >			Lo;							// List of offsets of group members from the centre of mass under object frame
+    vector< Quaterniond >		Lr;							// List of orientations (Qf) of group members relative to the object frame of the group
 };
 
 inline DEM_PARTICLE::DEM_PARTICLE(int tag, const Vector3d& x, double rho)
@@ -126,9 +132,9 @@ inline DEM_PARTICLE::DEM_PARTICLE(int tag, const Vector3d& x, double rho)
 
 	X 		= x;
 	X0 		= X;
-	Xmir.resize(0);
 	Rho		= rho;
 	R 		= 0.;
+	Rb 		= 0.;
 	M 		= 0.;
 	Kn	    = 1.0e3;
 	Kt		= 2.0e2;
@@ -161,11 +167,14 @@ inline DEM_PARTICLE::DEM_PARTICLE(int tag, const Vector3d& x, double rho)
 
 	Q0.w() = 1;
 	Q0.vec() << 0.,0.,0.;
+	Qf = Q;
+	Qfi = Q;
 
 	fixV	= false;
 	fixW	= false;
 	removed = false;
 	fixed	= false;
+	PValid	= true;
 	crossing[0] = false;
 	crossing[1] = false;
 	crossing[2] = false;
@@ -179,6 +188,8 @@ inline DEM_PARTICLE::DEM_PARTICLE(int tag, const Vector3d& x, double rho)
 	Ln.resize(0);
 	Lq.resize(0);
 	Lp.resize(0);
+	Lo.resize(0);
+	Lr.resize(0);
 
 	P0.resize(0);
 	Ps.resize(0);
@@ -272,11 +283,7 @@ inline void DEM_PARTICLE::VelocityVerlet(double dt)
 	Q.normalize();
 	Qf = Q0*Q;	// final rotation (from object frame to lab frame)
 	Qfi = Qf.inverse();
-	for (size_t i=0; i<P.size(); ++i)
-	{
-		P[i] = Qf._transformVector(P0[i]);
-		P[i] += X;
-	}
+	PValid = false;	// P is updated only when it is needed (contact or output)
 	//Update the angular velocity
 	Vector3d Aw0 = I.asDiagonal().inverse()*((Th + Tc + Tex));
 	// 5.45 and 5.54
@@ -290,10 +297,10 @@ inline void DEM_PARTICLE::VelocityVerlet(double dt)
 	// 5.59-61
 	Vector3d Aw2 = I.asDiagonal().inverse()*(-w1.cross(I.asDiagonal()*w1));
 	// 5.62
-	W	= w1 + 0.5*dt*Aw2;
+	W	= w0 + 0.5*dt*Aw2;
 	//store the acceleration for next update
 	Avb	= Av;
-	Awb	= Aw0+Aw1+Aw2;
+	Awb	= Aw0+Aw2;
 
 	if (constrained[0])		Constrain(0,dt);
 	if (constrained[1])		Constrain(1,dt);
@@ -315,7 +322,6 @@ inline void DEM_PARTICLE::UpdateBox(size_t D)
 		Max(d) = (int) (X(d)+BoxL(d));
 		Min(d) = (int) (X(d)-BoxL(d));
 	}
-	// Xmir.clear();
 	crossing[0] = false;
 	crossing[1] = false;
 	crossing[2] = false;
@@ -371,10 +377,42 @@ inline void DEM_PARTICLE::RerangeFaceElementOrder() // only works for convex sha
 	}
 }
 
+inline void DEM_PARTICLE::UpdateP()
+{
+	if (PValid)	return;
+	for (size_t i=0; i<P.size(); ++i)
+	{
+		P[i] = Qf._transformVector(P0[i]);
+		P[i] += X;
+	}
+	PValid = true;
+}
+
+inline void DEM_PARTICLE::SetAdjacency()
+{
+	Adj.assign(P0.size(), vector<size_t>());
+	vector<Vector2i> edges = Edges;
+	// edges of faces, i.e. consecutive vertices of each face
+	for (size_t i=0; i<Faces.size(); ++i)
+	for (int k=0; k<Faces[i].size(); ++k)
+	{
+		edges.push_back(Vector2i(Faces[i](k), Faces[i]((k+1)%Faces[i].size())));
+	}
+	for (size_t e=0; e<edges.size(); ++e)
+	{
+		size_t a = edges[e](0);
+		size_t b = edges[e](1);
+		if (a==b)	continue;
+		if (find(Adj[a].begin(), Adj[a].end(), b)==Adj[a].end())	Adj[a].push_back(b);
+		if (find(Adj[b].begin(), Adj[b].end(), a)==Adj[b].end())	Adj[b].push_back(a);
+	}
+}
+
 inline void DEM_PARTICLE::SetSphere(double r)
 {
     Type= 1;
 	R	= r;
+	Rb	= r;
 	Vol = 4./3.*M_PI*R*R*R;
 	M	= Rho*Vol;
 	I(0)	= 0.4*M*R*R;
@@ -401,6 +439,7 @@ inline void DEM_PARTICLE::SetDisk2D(double r)
 {
     Type= 2;
 	R	= r;
+	Rb	= r;
 	Vol = M_PI*R*R;
 	M	= Rho*Vol;
 	I(0)	= 0.25*M*R*R;
@@ -425,6 +464,7 @@ inline void DEM_PARTICLE::SetCuboid(double lx, double ly, double lz)
 {
     Type= 3;
 	R	= 0.1;
+	Rb	= 0.5*sqrt(lx*lx+ly*ly+lz*lz)+R;
 	Vol = lx*ly*lz;
 	M	= Rho*Vol;
 	I(0)	= M*(ly*ly+lz*lz)/12.;
@@ -461,6 +501,7 @@ inline void DEM_PARTICLE::SetCuboid(double lx, double ly, double lz)
 	Faces.push_back(face);
 
 	Nfe = 30;
+	SetAdjacency();
 
 	Max(0) 	= (int) (X(0)+BoxL(0));
 	Max(1) 	= (int) (X(1)+BoxL(1));
@@ -505,9 +546,13 @@ inline void DEM_PARTICLE::SetTetrahedron(vector<Vector3d> ver)
 	Quaterniond q0(em);
 	// rotation P0 to object frame
 	for (size_t i=0; i<P.size(); ++i)	P0[i] = q0.inverse()._transformVector(P0[i]);
+	for (size_t i=0; i<P0.size(); ++i)	Rb = max(Rb, P0[i].norm()+R);
 
 	Q0 = q0;
+	Qf = Q0*Q;
+	Qfi = Qf.inverse();
 	Nfe = 16;
+	SetAdjacency();
 
 	Max(0) 	= (int) (X(0)+BoxL(0));
 	Max(1) 	= (int) (X(1)+BoxL(1));
@@ -1,5 +1,7 @@
-// GJK algorithm for shortest distance calculatation between non-overlapping convex polyhedron
-// NOTE: This is not a general GJK since only NON-OVERLAPPING cases are considered here (07 Feb 2020).
+// GJK algorithm for shortest distance calculatation between convex polyhedra
+// Based on "Collision Detection in Interactive 3D Environments" (van den Bergen), chapter 4, and "Real-Time Collision Detection" (Ericson), 5.1 and 9.5.
+// The simplex is stored in fixed size arrays and the search starts from the separating axis of the previous step (warm start),
+// for slowly moving particles it usually converges in one or two iterations. Overlapping polyhedra are resolved by EPA.
 
 struct CSOPoint
 {
@@ -8,8 +10,16 @@ struct CSOPoint
 	size_t J;
 };
 
+// Simplex of GJK, at most 4 points of the configuration space obstacle (CSO)
+struct GJK_SIMPLEX
+{
+	CSOPoint P[4];
+	double L[4];															// Barycentric coordinates of the closest point to origin
+	size_t N;																// Number of points
+};
+
 // Return the index of farthest point in n direction
-size_t FarthestPoint(/*vertices*/vector<Vector3d> ver, /*dirction*/Vector3d n)
+inline size_t FarthestPoint(/*vertices*/const vector<Vector3d>& ver, /*dirction*/const Vector3d& n)
 {
 	size_t ind = 0;
 	double maxDot = ver[0].dot(n);
@@ -25,7 +35,34 @@ size_t FarthestPoint(/*vertices*/vector<Vector3d> ver, /*dirction*/Vector3d n)
 	return ind;
 }
 
-CSOPoint Support(vector<Vector3d>& veri, vector<Vector3d>& verj, Vector3d& n)
+// Return the index of farthest point in n direction by hill climbing from vertex start along the vertex adjacency adj.
+// A local maximum of a linear function on a convex polyhedron is the global one, so the result is the same as the linear scan
+// but only the vertices along the path are visited. Falls back to the linear scan for small shapes or missing adjacency.
+inline size_t FarthestPoint(const vector<Vector3d>& ver, const vector< vector<size_t> >& adj, const Vector3d& n, size_t start)
+{
+	if (ver.size()<16 || adj.size()!=ver.size())	return FarthestPoint(ver, n);
+	size_t ind = start;
+	double maxDot = ver[ind].dot(n);
+	bool moved = true;
+	while (moved)
+	{
+		moved = false;
+		const vector<size_t>& nb = adj[ind];
+		for (size_t k=0; k<nb.size(); ++k)
+		{
+			double dot = ver[nb[k]].dot(n);
+			if (dot>maxDot)
+			{
+				ind = nb[k];
+				maxDot = dot;
+				moved = true;
+			}
+		}
+	}
+	return ind;
+}
+
+inline CSOPoint Support(const vector<Vector3d>& veri, const vector<Vector3d>& verj, const Vector3d& n)
 {
 	CSOPoint p;
 	p.I = FarthestPoint(veri, n);
@@ -34,315 +71,372 @@ CSOPoint Support(vector<Vector3d>& veri, vector<Vector3d>& verj, Vector3d& n)
 	return p;
 }
 
-// Find the closest point from a line segment to origin
-Vector3d LineClosestPointToOrigin(Vector3d& A, Vector3d& B)
+// Support point with hill climbing from the last support point (si, sj)
+inline CSOPoint Support(const vector<Vector3d>& veri, const vector<Vector3d>& verj, const vector< vector<size_t> >& adji, const vector< vector<size_t> >& adjj, const Vector3d& n, size_t si, size_t sj)
 {
-	Vector3d AB = B-A;
-	double k = -A.dot(AB)/AB.squaredNorm();
-	Vector3d p = A;
-	if (k>1.)		p = B;
-	else if (k>0.)	p += k*AB;
+	CSOPoint p;
+	p.I = FarthestPoint(veri, adji, n, si);
+	p.J = FarthestPoint(verj, adjj, -n, sj);
+	p.X = veri[p.I]-verj[p.J];
 	return p;
 }
 
-Vector3d TriangleClosestPointToOrigin(/*the newest point*/Vector3d& A, Vector3d& B, Vector3d& C)
+// Keep points a and b of the simplex with barycentric coordinates la and lb
+inline void ReduceSimplex(GJK_SIMPLEX& s, size_t a, size_t b, double la, double lb)
 {
-	Vector3d AC = C-A;
-	Vector3d AB = B-A;
-	Vector3d ABC = AB.cross(AC);
-	Vector3d p;
+	CSOPoint pa = s.P[a];
+	CSOPoint pb = s.P[b];
+	s.P[0] = pa;
+	s.P[1] = pb;
+	s.L[0] = la;
+	s.L[1] = lb;
+	s.N = 2;
+}
 
-	if (A.dot(ABC.cross(AC))<0.)		p = LineClosestPointToOrigin(A, C);
-	else if (A.dot(AB.cross(ABC))<0.)	p = LineClosestPointToOrigin(A, B);
-	else								p = ABC.dot(A)/ABC.squaredNorm()*ABC;
-	return p;	
+// Keep point a of the simplex
+inline void ReduceSimplex(GJK_SIMPLEX& s, size_t a)
+{
+	s.P[0] = s.P[a];
+	s.L[0] = 1.;
+	s.N = 1;
 }
 
-// void TetrahedronDirectionToOrigin(/*the newest point*/Vector3d& A, Vector3d& B, Vector3d& C, Vector3d& D, Vector3d& n, size_t& ind0)
-// {
-// 	Vector3d BCD = (B-C).cross(D-C);
-// 	cout << "dot: " << ((B-C).cross(D-C)).dot(A-C) << endl;
-// 	if (((B-C).cross(D-C)).dot(A-C) == 0.)
-// 	{
-// 		cout << "intointointointointointointointointointointointointointointointointointointo" << endl;
-// 		Vector3d c0 = TriangleClosestPointToOrigin(A, B, C);
-// 		Vector3d c1 = TriangleClosestPointToOrigin(A, B, D);
-// 		Vector3d c2 = TriangleClosestPointToOrigin(A, C, D);
-// 		double cn0 = c0.norm(); double cn1 = c1.norm(); double cn2 = c2.norm();
-// 		double mind = min(cn0, min(cn1,cn2));
-// 		if (cn0==mind)
-// 		{
-// 			n = -c0;
-// 			ind0 = 0;
-// 		}
-// 		else if (cn1==mind)
-// 		{
-// 			n = -c1;
-// 			ind0 = 1;
-// 		}
-// 		else if (cn2==mind)
-// 		{
-// 			n = -c2;
-// 			ind0 = 2;
-// 		}
-// 	}
-// 	else
-// 	{
-// 		// find norm direction (towards to outside) of face ABC
-// 		Vector3d ABC = (B-A).cross(C-A);
-// 		if ((D-A).dot(ABC)>0.)	ABC *= -1;
-// 		if (A.dot(ABC)<0.)
-// 		{
-// 			n = -TriangleClosestPointToOrigin(A, B, C);
-// 			ind0 = 0;
-// 		}
-// 		else
-// 		{
-// 			Vector3d ACD = (C-A).cross(D-A);
-// 			if ((B-A).dot(ACD)>0.)	ACD *= -1;
-// 			if (A.dot(ACD)<0.)
-// 			{
-// 				n = -TriangleClosestPointToOrigin(A, C, D);
-// 				ind0 = 2;
-// 			}
-// 			else
-// 			{
-// 				n = -TriangleClosestPointToOrigin(A, B, D);
-// 				ind0 = 1;
-// 			}
-// 		}
-// 	}
-// }
+// Closest point of a line segment to origin
+inline void SegmentClosestPointToOrigin(GJK_SIMPLEX& s)
+{
+	Vector3d ab = s.P[1].X-s.P[0].X;
+	double ab2 = ab.squaredNorm();
+	double t = 0.;
+	if (ab2>0.)	t = -s.P[0].X.dot(ab)/ab2;
+	if 		(t<=0.)	ReduceSimplex(s, 0);
+	else if (t>=1.)	ReduceSimplex(s, 1);
+	else			ReduceSimplex(s, 0, 1, 1.-t, t);
+}
 
-void TetrahedronDirectionToOrigin(/*the newest point*/Vector3d& A, Vector3d& B, Vector3d& C, Vector3d& D, Vector3d& n, size_t& ind0)
+// Closest point of a triangle to origin (Ericson 5.1.5)
+inline void TriangleClosestPointToOrigin(GJK_SIMPLEX& s)
 {
-		// cout << "intointointointointointointointointointointointointointointointointointointo" << endl;
-		Vector3d c0 = TriangleClosestPointToOrigin(A, B, C);
-		Vector3d c1 = TriangleClosestPointToOrigin(A, B, D);
-		Vector3d c2 = TriangleClosestPointToOrigin(A, C, D);
-		double cn0 = c0.norm(); double cn1 = c1.norm(); double cn2 = c2.norm();
-		double mind = min(cn0, min(cn1,cn2));
-		if (cn0==mind)
-		{
-			n = -c0;
-			ind0 = 0;
-		}
-		else if (cn1==mind)
-		{
-			n = -c1;
-			ind0 = 1;
-		}
-		else if (cn2==mind)
-		{
-			n = -c2;
-			ind0 = 2;
-		}
+	Vector3d& a = s.P[0].X;
+	Vector3d& b = s.P[1].X;
+	Vector3d& c = s.P[2].X;
+	Vector3d ab = b-a;
+	Vector3d ac = c-a;
+	// Vertex region of a
+	double d1 = -ab.dot(a);
+	double d2 = -ac.dot(a);
+	if (d1<=0. && d2<=0.)
+	{
+		ReduceSimplex(s, 0);
+		return;
+	}
+	// Vertex region of b
+	double d3 = -ab.dot(b);
+	double d4 = -ac.dot(b);
+	if (d3>=0. && d4<=d3)
+	{
+		ReduceSimplex(s, 1);
+		return;
+	}
+	// Edge region of ab
+	double vc = d1*d4-d3*d2;
+	if (vc<=0. && d1>=0. && d3<=0.)
+	{
+		double t = d1/(d1-d3);
+		ReduceSimplex(s, 0, 1, 1.-t, t);
+		return;
+	}
+	// Vertex region of c
+	double d5 = -ab.dot(c);
+	double d6 = -ac.dot(c);
+	if (d6>=0. && d5<=d6)
+	{
+		ReduceSimplex(s, 2);
+		return;
+	}
+	// Edge region of ac
+	double vb = d5*d2-d1*d6;
+	if (vb<=0. && d2>=0. && d6<=0.)
+	{
+		double t = d2/(d2-d6);
+		ReduceSimplex(s, 0, 2, 1.-t, t);
+		return;
+	}
+	// Edge region of bc
+	double va = d3*d6-d5*d4;
+	if (va<=0. && (d4-d3)>=0. && (d5-d6)>=0.)
+	{
+		double t = (d4-d3)/((d4-d3)+(d5-d6));
+		ReduceSimplex(s, 1, 2, 1.-t, t);
+		return;
+	}
+	// Face region
+	double sum = va+vb+vc;
+	if (sum<=0.)
+	{
+		// degenerated triangle
+		s.N = 2;
+		SegmentClosestPointToOrigin(s);
+		return;
+	}
+	s.L[1] = vb/sum;
+	s.L[2] = vc/sum;
+	s.L[0] = 1.-s.L[1]-s.L[2];
+	s.N = 3;
 }
 
-bool CheckSimplex(vector<CSOPoint> s)
+// Closest point of a tetrahedron to origin (Ericson 5.1.6), N=4 is kept if the origin is inside
+inline void TetrahedronClosestPointToOrigin(GJK_SIMPLEX& s)
 {
-	bool tst = false;
-	for (size_t i=0; i<s.size()-1; ++i)
+	// faces and the vertex opposite to them
+	static const size_t face[4][4] = {{0,1,2,3}, {0,2,3,1}, {0,3,1,2}, {1,3,2,0}};
+	GJK_SIMPLEX best = GJK_SIMPLEX();
+	double minDis2 = 1.0e300;
+	bool inside = true;
+	for (size_t f=0; f<4; ++f)
 	{
-		if (s[s.size()-1].X==s[i].X)
+		Vector3d& a = s.P[face[f][0]].X;
+		Vector3d& b = s.P[face[f][1]].X;
+		Vector3d& c = s.P[face[f][2]].X;
+		Vector3d& d = s.P[face[f][3]].X;
+		Vector3d nf = (b-a).cross(c-a);
+		double sp = -nf.dot(a);												// side of origin
+		double sd = nf.dot(d-a);											// side of opposite vertex
+		// origin on the outer side of this face (or flat tetrahedron)
+		if (sp*sd<0. || sd*sd<=1.0e-24*nf.squaredNorm()*(d-a).squaredNorm())
 		{
-			tst = true;
-			break;
+			inside = false;
+			GJK_SIMPLEX t = GJK_SIMPLEX();
+			t.P[0] = s.P[face[f][0]];
+			t.P[1] = s.P[face[f][1]];
+			t.P[2] = s.P[face[f][2]];
+			t.N = 3;
+			TriangleClosestPointToOrigin(t);
+			Vector3d v (0.,0.,0.);
+			for (size_t k=0; k<t.N; ++k)	v += t.L[k]*t.P[k].X;
+			if (v.squaredNorm()<minDis2)
+			{
+				minDis2 = v.squaredNorm();
+				best = t;
+			}
 		}
 	}
-	return tst;
+	if (!inside)	s = best;
 }
 
-void showFunc(vector<Vector3d>& veri, vector<Vector3d>& verj, /*initial direction*/Vector3d& n, Vector3d& pi, Vector3d& pj)
+// Face of the polytope of EPA, vertices are counterclockwise seen from outside
+struct EPA_FACE
 {
-	vector<CSOPoint> simplex;
-	// Add first point to simplex
-	simplex.push_back(Support(veri, verj, n));
-	// Add second point to simplex
-	n = -simplex[0].X;
-	simplex.push_back(Support(veri, verj, n));
-	// Add third point to simplex
-	n = -LineClosestPointToOrigin(simplex[0].X, simplex[1].X);
-	cout << "n line: " << n.transpose() << endl;
-	simplex.push_back(Support(veri, verj, n));
-
-	if (CheckSimplex(simplex))
-	{
-		double lamda = (-n-simplex[1].X).norm()/(simplex[0].X-simplex[1].X).norm();
-		cout << "lamda: " << lamda << endl;
-		cout << "simplex[0].X: " << simplex[0].X.transpose() << endl;
-		cout << "simplex[1].X: " << simplex[1].X.transpose() << endl;
-		cout << "-n: " << -n.transpose() << endl;
-
-		cout << "cal n: " << (lamda*simplex[0].X+(1.-lamda)*simplex[1].X).transpose() << endl;
+	size_t V[3];															// Indices of vertices
+	Vector3d N;																// Outward unit normal
+	double D;																// Distance to origin
+	bool Valid;
+};
 
-		cout << veri[simplex[0].I].transpose() << endl;
-		cout << veri[simplex[1].I].transpose() << endl;
-		cout << "--------------------" << endl;
-		cout << verj[simplex[0].J].transpose() << endl;
-		cout << verj[simplex[1].J].transpose() << endl;
+// Set vertices, normal and distance to origin of face f
+inline bool SetEPAFace(EPA_FACE& f, const CSOPoint* ver, size_t a, size_t b, size_t c)
+{
+	f.V[0] = a;
+	f.V[1] = b;
+	f.V[2] = c;
+	f.N = (ver[b].X-ver[a].X).cross(ver[c].X-ver[a].X);
+	double l = f.N.norm();
+	f.Valid = l>0.;
+	if (!f.Valid)	return false;
+	f.N /= l;
+	f.D = f.N.dot(ver[a].X);
+	return true;
+}
 
-		pi = lamda*veri[simplex[0].I] + (1.-lamda)*veri[simplex[1].I];
-		pj = lamda*verj[simplex[0].J] + (1.-lamda)*verj[simplex[1].J];
-		// simplex.pop_back();
-		// Vector3d ni = -n;
-		// simplex.push_back(Support(veri, verj, ni));
-		// if (CheckSimplex(simplex))
-		// {
-		// 	cout << "still cannot form Triangle" << endl;
-		// }
-	}
-	else
+// Expanding polytope algorithm (van den Bergen 4.3.8) for the penetration depth of overlapping polyhedra,
+// starts from the tetrahedron of GJK which contains the origin. The memory is fixed and the iterations are bounded,
+// the best face found so far is used if the limits are reached.
+// On return n is the outward normal of the closest face of the CSO, depth the distance to it, pi-pj=depth*n.
+inline bool PenetrationDepth(const vector<Vector3d>& veri, const vector<Vector3d>& verj, const vector< vector<size_t> >& adji, const vector< vector<size_t> >& adjj, const Vector3d& shi, GJK_SIMPLEX& s, Vector3d& n, double& depth, Vector3d& pi, Vector3d& pj)
+{
+	const size_t maxV = 64;													// Max number of vertices
+	const size_t maxF = 128;												// Max number of faces
+	const size_t maxE = 64;													// Max number of horizon edges
+	CSOPoint ver[maxV];
+	EPA_FACE face[maxF];
+	size_t edge[maxE][2];
+	size_t nv = 4;
+	size_t nf = 4;
+	for (size_t k=0; k<4; ++k)	ver[k] = s.P[k];
+	// make sure the faces of the tetrahedron are counterclockwise seen from outside
+	if ((ver[1].X-ver[0].X).cross(ver[2].X-ver[0].X).dot(ver[3].X-ver[0].X)>0.)	swap(ver[1], ver[2]);
+	bool valid = true;
+	valid = SetEPAFace(face[0], ver, 0, 1, 2) && valid;
+	valid = SetEPAFace(face[1], ver, 0, 3, 1) && valid;
+	valid = SetEPAFace(face[2], ver, 0, 2, 3) && valid;
+	valid = SetEPAFace(face[3], ver, 1, 3, 2) && valid;
+	if (!valid)	return false;
+
+	size_t best = 0;
+	for (size_t it=0; it<32; ++it)
 	{
-		Vector3d A = simplex[2].X;
-		Vector3d B = simplex[1].X;
-		Vector3d C = simplex[0].X;
-
-		cout << "A: " << A << endl;
-		cout << "B: " << B << endl;
-		cout << "C: " << C << endl;
-
-		n = -TriangleClosestPointToOrigin(A, B, C);
-		cout << "n: " << n.transpose() << endl;
-		simplex.push_back(Support(veri, verj, n));
-
-		cout << "D: " << simplex[3].X.transpose() << endl;
-
-		size_t ind0;
-		size_t count = 0;
-		while (!CheckSimplex(simplex))
+		// closest face to origin
+		best = maxF;
+		for (size_t f=0; f<nf; ++f)
 		{
-			cout << "befrore simplex[3].X: " << simplex[3].X.transpose() << endl;
-			cout << "befrore simplex[2].X: " << simplex[2].X.transpose() << endl;
-			cout << "befrore simplex[1].X: " << simplex[1].X.transpose() << endl;
-			cout << "befrore simplex[0].X: " << simplex[0].X.transpose() << endl;
-			cout << "----------------------------------------------" << endl;
-			Vector3d nb = n;
-			TetrahedronDirectionToOrigin(simplex[3].X, simplex[2].X, simplex[1].X, simplex[0].X, n, ind0);
-			cout << "ind0= " << ind0 << endl;
-			simplex.erase(simplex.begin()+ind0);
-			simplex.push_back(Support(veri, verj, n));
-			cout << "simplex[3].X: " << simplex[3].X.transpose() << endl;
-			cout << "simplex[2].X: " << simplex[2].X.transpose() << endl;
-			cout << "simplex[1].X: " << simplex[1].X.transpose() << endl;
-			cout << "simplex[0].X: " << simplex[0].X.transpose() << endl;
-
-			cout << "n.norm(): " << n.norm() << endl;
-
-			cout << "ang: " << acos(nb.dot(n)/nb.norm()/n.norm())*180/M_PI << endl;
-			cout << "============================================" << endl;
-			count++;
-			if (count>100)
+			if (face[f].Valid && (best==maxF || face[f].D<face[best].D))	best = f;
+		}
+		if (best==maxF)	return false;
+		EPA_FACE& fb = face[best];
+		CSOPoint w = Support(veri, verj, adji, adjj, fb.N, ver[fb.V[0]].I, ver[fb.V[0]].J);
+		w.X += shi;
+		// the support point does not expand the polytope further
+		if (w.X.dot(fb.N)-fb.D<=1.0e-6*fb.D+1.0e-12)	break;
+		bool duplicate = false;
+		for (size_t k=0; k<nv; ++k)	if (ver[k].I==w.I && ver[k].J==w.J)	duplicate = true;
+		if (duplicate || nv==maxV)	break;
+		// horizon of the faces seen from w
+		size_t ne = 0;
+		size_t nvis = 0;
+		bool full = false;
+		for (size_t f=0; f<nf && !full; ++f)
+		{
+			if (!face[f].Valid || face[f].N.dot(w.X-ver[face[f].V[0]].X)<=0.)	continue;
+			nvis++;
+			for (size_t k=0; k<3; ++k)
 			{
-				cout << "loop 100 times and still not find GJK solution!" << endl;
-				cout << "veri[0]: "<< veri[0].transpose() << endl;
-				cout << "verj[0]: "<< verj[0].transpose() << endl;
-				abort();
-			}	
+				size_t a = face[f].V[k];
+				size_t b = face[f].V[(k+1)%3];
+				// an edge shared by two visible faces is not on the horizon
+				bool shared = false;
+				for (size_t e=0; e<ne; ++e)
+				{
+					if (edge[e][0]==b && edge[e][1]==a)
+					{
+						edge[e][0] = edge[ne-1][0];
+						edge[e][1] = edge[ne-1][1];
+						ne--;
+						shared = true;
+						break;
+					}
+				}
+				if (shared)	continue;
+				if (ne==maxE)
+				{
+					full = true;
+					break;
+				}
+				edge[ne][0] = a;
+				edge[ne][1] = b;
+				ne++;
+			}
 		}
-
-		// for (size_t i=0; i<simplex.size(); ++i)
-		// {
-		// 	cout << simplex[i].X.transpose() << endl;
-		// }
-
-		Vector3d cp = TriangleClosestPointToOrigin(simplex[2].X, simplex[1].X, simplex[0].X);
-
-		Matrix3d mat;
-		mat.col(0) = simplex[0].X;
-		mat.col(1) = simplex[1].X;
-		mat.col(2) = simplex[2].X;
-		Vector3d coef = mat.inverse()*cp;
-		cout << "coef: " << coef.transpose() << endl;
-
-		pi = coef(0)*veri[simplex[0].I] + coef(1)*veri[simplex[1].I] + coef(2)*veri[simplex[2].I];
-		pj = coef(0)*verj[simplex[0].J] + coef(1)*verj[simplex[1].J] + coef(2)*verj[simplex[2].J];
-
-		cout << veri[simplex[0].I].transpose() << endl;
-		cout << veri[simplex[1].I].transpose() << endl;
-		cout << veri[simplex[2].I].transpose() << endl;
-		cout << "--------------------" << endl;
-		cout << verj[simplex[0].J].transpose() << endl;
-		cout << verj[simplex[1].J].transpose() << endl;
-		cout << verj[simplex[2].J].transpose() << endl;
+		if (full || nvis==0 || nf-nvis+ne>maxF)	break;
+		// remove visible faces and close the hole with faces to w
+		for (size_t f=0; f<nf; ++f)
+		{
+			if (face[f].Valid && face[f].N.dot(w.X-ver[face[f].V[0]].X)>0.)	face[f].Valid = false;
+		}
+		ver[nv] = w;
+		size_t f = 0;
+		for (size_t e=0; e<ne; ++e)
+		{
+			while (f<nf && face[f].Valid)	f++;
+			if (f==nf)	nf++;
+			SetEPAFace(face[f], ver, edge[e][0], edge[e][1], nv);
+		}
+		nv++;
 	}
-
-	cout << "cpi: " << pi.transpose() << endl;
-	cout << "cpj: " << pj.transpose() << endl;
+	if (best==maxF)	return false;
+	EPA_FACE& fb = face[best];
+	n = fb.N;
+	depth = fb.D;
+	// barycentric coordinates of the projection of origin on the face
+	Vector3d& a = ver[fb.V[0]].X;
+	Vector3d& b = ver[fb.V[1]].X;
+	Vector3d& c = ver[fb.V[2]].X;
+	Vector3d p = depth*n;
+	Vector3d v0 = b-a, v1 = c-a, v2 = p-a;
+	double d00 = v0.dot(v0), d01 = v0.dot(v1), d11 = v1.dot(v1), d20 = v2.dot(v0), d21 = v2.dot(v1);
+	double den = d00*d11-d01*d01;
+	double l1 = (d11*d20-d01*d21)/den;
+	double l2 = (d00*d21-d01*d20)/den;
+	double l0 = 1.-l1-l2;
+	pi = l0*veri[ver[fb.V[0]].I]+l1*veri[ver[fb.V[1]].I]+l2*veri[ver[fb.V[2]].I]+shi;
+	pj = l0*verj[ver[fb.V[0]].J]+l1*verj[ver[fb.V[1]].J]+l2*verj[ver[fb.V[2]].J];
+	return true;
 }
 
-void FindClosestPoints3D(vector<Vector3d>& veri, vector<Vector3d>& verj, /*initial direction*/Vector3d& n, Vector3d& pi, Vector3d& pj)
+// Find the closest points between convex polyhedra veri (shifted by shi) and verj, adji and adjj are their vertex adjacency (can be empty).
+// v is the separating axis used as the initial search direction on input (zero for none) and the direction from pj to pi
+// (to push pi out of contact) on output, dis is the distance, negative for the penetration depth of overlapping polyhedra.
+// Returns false as soon as the distance is proven to be larger than sep, pi, pj and dis are not calculated in this case.
+inline bool FindClosestPoints3D(const vector<Vector3d>& veri, const vector<Vector3d>& verj, const vector< vector<size_t> >& adji, const vector< vector<size_t> >& adjj, const Vector3d& shi, double sep, Vector3d& v, Vector3d& pi, Vector3d& pj, double& dis)
 {
-	Vector3d n0 = n;
-	vector<CSOPoint> simplex;
-	// Add first point to simplex
-	simplex.push_back(Support(veri, verj, n));
-	// Add second point to simplex
-	n = -simplex[0].X;
-	simplex.push_back(Support(veri, verj, n));
-	// Add third point to simplex
-	n = -LineClosestPointToOrigin(simplex[0].X, simplex[1].X);;
-	simplex.push_back(Support(veri, verj, n));
-
-	Vector3d A = simplex[2].X;
-	Vector3d B = simplex[1].X;
-	Vector3d C = simplex[0].X;
-
-	n = -TriangleClosestPointToOrigin(A, B, C);
-	simplex.push_back(Support(veri, verj, n));
-
-	size_t ind0;
-	size_t count = 0;
-	while (!CheckSimplex(simplex))
+	Vector3d v0 = v;
+	if (v.squaredNorm()==0.)	v = veri[0]+shi-verj[0];
+	GJK_SIMPLEX s;
+	s.N = 0;
+	bool overlap = false;
+	size_t si = 0, sj = 0;													// last support points, start of hill climbing
+	for (size_t it=0; it<64; ++it)
 	{
-		TetrahedronDirectionToOrigin(simplex[3].X, simplex[2].X, simplex[1].X, simplex[0].X, n, ind0);
-		simplex.erase(simplex.begin()+ind0);
-		double disb = n.norm();
-		simplex.push_back(Support(veri, verj, n));
-		double dis = n.norm();
-		count++;
-		if (count>100)
+		CSOPoint w = Support(veri, verj, adji, adjj, -v, si, sj);
+		si = w.I;
+		sj = w.J;
+		w.X += shi;
+		double vw = v.dot(w.X);
+		double v2 = v.squaredNorm();
+		// vw/|v| is a lower bound of the distance
+		if (vw>0. && vw*vw>sep*sep*v2)	return false;
+		if (s.N>0)
 		{
-			cout << "loop 100 times and still not find GJK solution!" << endl;
-			cout << "veri[0]: "<< veri[0].transpose() << endl;
-			cout << "verj[0]: "<< verj[0].transpose() << endl;
-			Vector3d pi0, pj0;
-			showFunc(veri, verj, n0, pi0, pj0);
-
-			abort();
+			// no progress towards origin
+			if (v2-vw<=1.0e-12*v2)	break;
+			bool duplicate = false;
+			for (size_t k=0; k<s.N; ++k)	if (s.P[k].I==w.I && s.P[k].J==w.J)	duplicate = true;
+			if (duplicate)	break;
+		}
+		s.P[s.N] = w;
+		s.N++;
+		if 		(s.N==2)	SegmentClosestPointToOrigin(s);
+		else if (s.N==3)	TriangleClosestPointToOrigin(s);
+		else if (s.N==4)	TetrahedronClosestPointToOrigin(s);
+		if (s.N==1)	s.L[0] = 1.;
+		if (s.N==4)
+		{
+			overlap = true;
+			break;
 		}
-		if (dis<disb)
+		v.setZero();
+		for (size_t k=0; k<s.N; ++k)	v += s.L[k]*s.P[k].X;
+		if (v.squaredNorm()<=1.0e-24)
 		{
-			cout << "dis<disb" << endl;
-		}	
+			overlap = true;
+			break;
+		}
 	}
-
-	// for (size_t i=0; i<simplex.size(); ++i)
-	// {
-	// 	cout << simplex[i].X.transpose() << endl;
-	// }
-
-	Vector3d cp = TriangleClosestPointToOrigin(simplex[2].X, simplex[1].X, simplex[0].X);
-
-	Matrix3d mat;
-	mat.col(0) = simplex[0].X;
-	mat.col(1) = simplex[1].X;
-	mat.col(2) = simplex[2].X;
-	Vector3d coef = mat.inverse()*cp;
-	cout << "coef: " << coef.transpose() << endl;
-
-	pi = coef(0)*veri[simplex[0].I] + coef(1)*veri[simplex[1].I] + coef(2)*veri[simplex[2].I];
-	pj = coef(0)*verj[simplex[0].J] + coef(1)*verj[simplex[1].J] + coef(2)*verj[simplex[2].J];
-
-
-	cout << veri[simplex[0].I].transpose() << endl;
-	cout << veri[simplex[1].I].transpose() << endl;
-	cout << veri[simplex[2].I].transpose() << endl;
-	cout << "--------------------" << endl;
-	cout << verj[simplex[0].J].transpose() << endl;
-	cout << verj[simplex[1].J].transpose() << endl;
-	cout << verj[simplex[2].J].transpose() << endl;
-
-	cout << "cpi: " << pi.transpose() << endl;
-	cout << "cpj: " << pj.transpose() << endl;
-}
\ No newline at end of file
+	if (overlap)
+	{
+		Vector3d n;
+		double depth;
+		if (s.N==4 && PenetrationDepth(veri, verj, adji, adjj, shi, s, n, depth, pi, pj))
+		{
+			v = -n;
+			dis = -depth;
+		}
+		else
+		{
+			// touching cores (origin on the boundary of CSO), keep the initial direction
+			v = v0;
+			pi = veri[s.P[0].I]+shi;
+			pj = pi;
+			dis = 0.;
+		}
+		return true;
+	}
+	pi.setZero();
+	pj.setZero();
+	for (size_t k=0; k<s.N; ++k)
+	{
+		pi += s.L[k]*veri[s.P[k].I];
+		pj += s.L[k]*verj[s.P[k].J];
+	}
+	pi += shi;
+	dis = v.norm();
+	return true;
+}
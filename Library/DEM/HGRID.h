@@ -0,0 +1,222 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Hierarchical grid for broad phase contact detection of polydisperse particles
+// Based on "Real-Time Collision Detection" (Ericson), section 7.2
+// Level k has a cell size of at least H0*2^k, every particle is stored once in the cell containing its centre at the finest level
+// whose cell size is not smaller than its bounding diameter. A particle only checks the 3^D neighbour cells at its own and all coarser levels,
+// so a large particle costs the same as a small one.
+
+class HGRID
+{
+public:
+	HGRID();
+	void Build(vector<DEM_PARTICLE*>& lp, size_t np0, size_t nproc);						// Sort particles (from index np0) into cells
+	void FindPairs(vector<DEM_PARTICLE*>& lp, size_t np0, size_t nproc, vector< vector<size_t> >& lc);	// Append pairs with overlapping bounding spheres to lc
+	void CellIndex(size_t k, Vector3d& x, int* c);											// Cell coordinates of position x at level k
+	void MinimumImage(Vector3d& dx);														// Shift a relative position to its closest periodic image
+
+	size_t 							D;														// Dimension
+	double 							L[3];													// Domain period in each direction
+	bool 							Periodic[3];
+	double 							H0;														// Cell size of the finest level
+	double 							Skin;													// Extra distance added to bounding spheres when searching pairs
+	size_t 							Nl;														// Number of levels
+
+	vector<Vector3i> 				Nc;														// Number of cells in each direction of each level
+	vector<Vector3d> 				Hc;														// Cell size in each direction of each level
+	vector< vector<size_t> > 		Start;													// Start index in List of each cell (CSR), of each level
+	vector< vector<size_t> > 		List;													// Particle indices sorted by cells, of each level
+	vector<size_t> 					Level;													// Level of each particle
+	vector<size_t> 					Cell;													// Cell of each particle at its level
+};
+
+inline HGRID::HGRID()
+{
+	D = 3;
+	for (size_t d=0; d<3; ++d)
+	{
+		L[d] = 1.;
+		Periodic[d] = false;
+	}
+	H0 = 1.;
+	Skin = 0.;
+	Nl = 0;
+}
+
+inline void HGRID::CellIndex(size_t k, Vector3d& x, int* c)
+{
+	for (size_t d=0; d<3; ++d)
+	{
+		if (d<D)
+		{
+			double xd = x(d);
+			if (Periodic[d])	xd -= floor(xd/L[d])*L[d];
+			c[d] = (int) (xd/Hc[k](d));
+			c[d] = max(0, min(c[d], Nc[k](d)-1));
+		}
+		else	c[d] = 0;
+	}
+}
+
+inline void HGRID::MinimumImage(Vector3d& dx)
+{
+	for (size_t d=0; d<D; ++d)
+	{
+		if (Periodic[d])
+		{
+			if 		(dx(d)> 0.5*L[d])	dx(d) -= L[d];
+			else if (dx(d)<-0.5*L[d])	dx(d) += L[d];
+		}
+	}
+}
+
+inline void HGRID::Build(vector<DEM_PARTICLE*>& lp, size_t np0, size_t nproc)
+{
+	size_t np = lp.size()-np0;
+	Level.resize(np);
+	Cell.resize(np);
+	Nl = 0;
+	if (np==0)	return;
+	// the finest cell size fits the smallest particle
+	double rmin = 1.0e300;
+	for (size_t a=0; a<np; ++a)	rmin = min(rmin, lp[a+np0]->Rb+0.5*Skin);
+	H0 = max(2.*rmin, 1.0e-12);
+	// limit the number of cells of the finest level for very small particles
+	double vol = 1.;
+	for (size_t d=0; d<D; ++d)	vol *= L[d];
+	while (vol/pow(H0,D)>4.*np+1000.)	H0 *= 2.;
+
+	#pragma omp parallel for schedule(static) num_threads(nproc)
+	for (size_t a=0; a<np; ++a)
+	{
+		size_t k = 0;
+		double h = H0;
+		while (h<2.*lp[a+np0]->Rb+Skin)
+		{
+			h *= 2.;
+			k++;
+		}
+		Level[a] = k;
+	}
+	for (size_t a=0; a<np; ++a)	Nl = max(Nl, Level[a]+1);
+
+	Nc.resize(Nl);
+	Hc.resize(Nl);
+	Start.resize(Nl);
+	List.resize(Nl);
+	for (size_t k=0; k<Nl; ++k)
+	{
+		double h = H0*pow(2.,k);
+		size_t nc = 1;
+		for (size_t d=0; d<3; ++d)
+		{
+			Nc[k](d) = 1;
+			Hc[k](d) = L[d];
+			if (d<D)
+			{
+				Nc[k](d) = max(1, (int) floor(L[d]/h));
+				Hc[k](d) = L[d]/Nc[k](d);
+			}
+			nc *= Nc[k](d);
+		}
+		Start[k].assign(nc+1, 0);
+	}
+
+	#pragma omp parallel for schedule(static) num_threads(nproc)
+	for (size_t a=0; a<np; ++a)
+	{
+		size_t k = Level[a];
+		int c[3];
+		CellIndex(k, lp[a+np0]->X, c);
+		Cell[a] = (c[0]*Nc[k](1)+c[1])*Nc[k](2)+c[2];
+	}
+	// counting sort of particles by cells
+	for (size_t a=0; a<np; ++a)	Start[Level[a]][Cell[a]+1]++;
+	for (size_t k=0; k<Nl; ++k)
+	{
+		for (size_t c=1; c<Start[k].size(); ++c)	Start[k][c] += Start[k][c-1];
+		List[k].resize(Start[k].back());
+	}
+	vector< vector<size_t> > fill (Nl);
+	for (size_t k=0; k<Nl; ++k)	fill[k].assign(Start[k].begin(), Start[k].end()-1);
+	for (size_t a=0; a<np; ++a)
+	{
+		size_t k = Level[a];
+		List[k][fill[k][Cell[a]]++] = a;
+	}
+}
+
+inline void HGRID::FindPairs(vector<DEM_PARTICLE*>& lp, size_t np0, size_t nproc, vector< vector<size_t> >& lc)
+{
+	size_t np = lp.size()-np0;
+	if (Nl==0)	return;
+	// pairs found by each thread, static schedule keeps the same order as a serial loop
+	vector< vector< vector<size_t> > > lct (nproc);
+	#pragma omp parallel for schedule(static) num_threads(nproc)
+	for (size_t a=0; a<np; ++a)
+	{
+		size_t p = a+np0;
+		DEM_PARTICLE* p0 = lp[p];
+		vector< vector<size_t> >& lcp = lct[omp_get_thread_num()];
+		for (size_t k=Level[a]; k<Nl; ++k)
+		{
+			int c[3];
+			CellIndex(k, p0->X, c);
+			// unique neighbour cells in each direction
+			int nb[3][3];
+			int nn[3];
+			for (size_t d=0; d<3; ++d)
+			{
+				nn[d] = 0;
+				if (Nc[k](d)<3)
+				{
+					for (int i=0; i<Nc[k](d); ++i)	nb[d][nn[d]++] = i;
+				}
+				else
+				{
+					for (int i=-1; i<2; ++i)
+					{
+						int ci = c[d]+i;
+						if (Periodic[d])				nb[d][nn[d]++] = (ci+Nc[k](d))%Nc[k](d);
+						else if (ci>-1 && ci<Nc[k](d))	nb[d][nn[d]++] = ci;
+					}
+				}
+			}
+			for (int i=0; i<nn[0]; ++i)
+			for (int j=0; j<nn[1]; ++j)
+			for (int l=0; l<nn[2]; ++l)
+			{
+				size_t cn = (nb[0][i]*Nc[k](1)+nb[1][j])*Nc[k](2)+nb[2][l];
+				for (size_t m=Start[k][cn]; m<Start[k][cn+1]; ++m)
+				{
+					size_t q = List[k][m]+np0;
+					// pairs at the same level are found twice, keep the one from the smaller index
+					if (k==Level[a] && q<=p)	continue;
+					DEM_PARTICLE* q0 = lp[q];
+					Vector3d dx = q0->X-p0->X;
+					MinimumImage(dx);
+					double rpq = p0->Rb+q0->Rb+Skin;
+					if (dx.squaredNorm()<rpq*rpq)	lcp.push_back({min(p,q), max(p,q)});
+				}
+			}
+		}
+	}
+	for (size_t i=0; i<nproc; ++i)	lc.insert(lc.end(), lct[i].begin(), lct[i].end());
+}
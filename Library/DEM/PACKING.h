@@ -0,0 +1,469 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Generator of initial packings of spheres (disks in 2D) in a box [X0, X1]
+// RSA: random sequential addition, candidates are tested in parallel against the packing and accepted in serial.
+// PoissonDisk: Bridson's algorithm ("Fast Poisson disk sampling in arbitrary dimensions", 2007), dense and uniform in O(N).
+// Settle: position based settling under a constant displacement per iteration, overlaps are relaxed by Jacobi sweeps.
+// All searches use a uniform grid with linked lists of cells (cell size 2*Rmax+SurDis).
+// The result is written with the datasets (Position, Radius, Tag) of DEM::WriteFileH5 or added to a DEM directly.
+
+class PACKING
+{
+public:
+	PACKING(size_t d, const Vector3d& x0, const Vector3d& x1);
+	void SetRadius(double r);																// All particles with radius r
+	void SetRadiusUniform(double rmin, double rmax);										// Radii uniformly distributed in [rmin, rmax]
+	void SetRadiusDistribution(vector<double>& r, vector<double>& frac);					// Discrete radii r with number fractions frac
+	double SampleRadius(uint64_t& state);
+	void Add(const Vector3d& x, double r, int tag);											// Add a particle directly, e.g. existing particles as obstacles
+	size_t RSA(size_t np, int tag, size_t maxTries);										// Add up to np particles, give up after maxTries failed candidates of one particle
+	size_t PoissonDisk(int tag, size_t k);													// Fill the box, k candidates around each active particle
+	void Settle(const Vector3d& dx, size_t nit, size_t nsweep);								// Move particles by dx per iteration and relax overlaps
+	double SolidFraction();
+	void WriteH5(string fname);
+
+	// uniform grid
+	void BuildGrid();
+	size_t CellIndex(const Vector3d& x);
+	bool Overlap(const Vector3d& x, double r, size_t skip);									// Check if a particle at x overlaps (closer than SurDis) with any particle except skip
+	void InsertGrid(size_t i);
+
+	size_t 							D;														// Dimension
+	size_t 							Nproc;
+	uint64_t 						Seed;													// Seed of random numbers, results do not depend on Nproc
+	double 							SurDis;													// Minimum surface distance between particles
+	double 							Margin;													// Minimum distance between particles and box faces
+	Vector3d 						X0;														// Lower corner of the box
+	Vector3d 						X1;														// Upper corner of the box
+
+	vector<Vector3d> 				X;														// Positions
+	vector<double> 					R;														// Radii
+	vector<int> 					Tag;													// Tags
+
+	vector<double> 					Rd;														// Radii of the size distribution
+	vector<double> 					Cdf;													// Cumulative number fractions of Rd (empty for uniform distribution in [Rd[0], Rd[1]])
+	double 							Rmax;													// Max radius of the packing and size distribution
+
+	double 							H;														// Cell size
+	Vector3i 						Nc;														// Number of cells in each direction
+	vector<long> 					Head;													// First particle of each cell
+	vector<long> 					Next;													// Next particle in the same cell
+};
+
+// Random numbers (splitmix64), cheap to seed for each particle so that results are independent of threads
+inline uint64_t SplitMix64(uint64_t& state)
+{
+	uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+	z = (z^(z>>27))*0x94D049BB133111EBULL;
+	return z^(z>>31);
+}
+
+inline double Uniform01(uint64_t& state)
+{
+	return (SplitMix64(state)>>11)*(1.0/9007199254740992.0);
+}
+
+inline PACKING::PACKING(size_t d, const Vector3d& x0, const Vector3d& x1)
+{
+	D = d;
+	Nproc = 1;
+	Seed = 1;
+	SurDis = 0.;
+	Margin = 0.;
+	X0 = x0;
+	X1 = x1;
+	Rmax = 0.;
+	H = 1.;
+	Nc << 1, 1, 1;
+	SetRadius(1.);
+}
+
+inline void PACKING::SetRadius(double r)
+{
+	Rd.assign(1, r);
+	Cdf.assign(1, 1.);
+}
+
+inline void PACKING::SetRadiusUniform(double rmin, double rmax)
+{
+	Rd = {rmin, rmax};
+	Cdf.clear();
+}
+
+inline void PACKING::SetRadiusDistribution(vector<double>& r, vector<double>& frac)
+{
+	if (r.size()!=frac.size() || r.size()==0)
+	{
+		cout << "\033[1;31mError: Sizes of radii and fractions are not the same.\033[0m\n";
+		exit(0);
+	}
+	Rd = r;
+	Cdf.resize(r.size());
+	double sum = 0.;
+	for (size_t i=0; i<r.size(); ++i)
+	{
+		sum += frac[i];
+		Cdf[i] = sum;
+	}
+	for (size_t i=0; i<r.size(); ++i)	Cdf[i] /= sum;
+}
+
+inline double PACKING::SampleRadius(uint64_t& state)
+{
+	double u = Uniform01(state);
+	if (Cdf.size()==0)	return Rd[0]+u*(Rd[1]-Rd[0]);
+	size_t i = 0;
+	while (i<Cdf.size()-1 && u>Cdf[i])	i++;
+	return Rd[i];
+}
+
+inline void PACKING::Add(const Vector3d& x, double r, int tag)
+{
+	X.push_back(x);
+	R.push_back(r);
+	Tag.push_back(tag);
+}
+
+inline void PACKING::BuildGrid()
+{
+	Rmax = 0.;
+	for (size_t i=0; i<Rd.size(); ++i)	Rmax = max(Rmax, Rd[i]);
+	for (size_t i=0; i<R.size(); ++i)	Rmax = max(Rmax, R[i]);
+	H = 2.*Rmax+SurDis;
+	size_t nc = 1;
+	for (size_t d=0; d<3; ++d)
+	{
+		Nc(d) = 1;
+		if (d<D)	Nc(d) = max(1, (int) ceil((X1(d)-X0(d))/H));
+		nc *= Nc(d);
+	}
+	Head.assign(nc, -1);
+	Next.assign(X.size(), -1);
+	for (size_t i=0; i<X.size(); ++i)	InsertGrid(i);
+}
+
+inline size_t PACKING::CellIndex(const Vector3d& x)
+{
+	int c[3] = {0, 0, 0};
+	for (size_t d=0; d<D; ++d)
+	{
+		c[d] = (int) floor((x(d)-X0(d))/H);
+		c[d] = max(0, min(c[d], Nc(d)-1));
+	}
+	return (c[0]*Nc(1)+c[1])*Nc(2)+c[2];
+}
+
+inline void PACKING::InsertGrid(size_t i)
+{
+	if (Next.size()<X.size())	Next.resize(X.size(), -1);
+	size_t c = CellIndex(X[i]);
+	Next[i] = Head[c];
+	Head[c] = i;
+}
+
+inline bool PACKING::Overlap(const Vector3d& x, double r, size_t skip)
+{
+	int c[3] = {0, 0, 0};
+	for (size_t d=0; d<D; ++d)
+	{
+		c[d] = (int) floor((x(d)-X0(d))/H);
+		c[d] = max(0, min(c[d], Nc(d)-1));
+	}
+	int lo[3], hi[3];
+	for (size_t d=0; d<3; ++d)
+	{
+		lo[d] = max(0, c[d]-1);
+		hi[d] = min(Nc(d)-1, c[d]+1);
+	}
+	for (int i=lo[0]; i<=hi[0]; ++i)
+	for (int j=lo[1]; j<=hi[1]; ++j)
+	for (int k=lo[2]; k<=hi[2]; ++k)
+	{
+		for (long q=Head[(i*Nc(1)+j)*Nc(2)+k]; q!=-1; q=Next[q])
+		{
+			if ((size_t) q==skip)	continue;
+			double rs = r+R[q]+SurDis;
+			if ((X[q]-x).squaredNorm()<rs*rs)	return true;
+		}
+	}
+	return false;
+}
+
+inline size_t PACKING::RSA(size_t np, int tag, size_t maxTries)
+{
+	auto t_start = std::chrono::steady_clock::now();
+	BuildGrid();
+	// larger particles first, they are the hardest to place
+	vector<double> rs (np);
+	for (size_t i=0; i<np; ++i)
+	{
+		uint64_t state = Seed*0x2545F4914F6CDD1DULL+i;
+		rs[i] = SampleRadius(state);
+	}
+	sort(rs.begin(), rs.end(), greater<double>());
+
+	size_t nadd = 0;
+	size_t nfail = 0;
+	size_t nb = 256;														// particles per batch, fixed so that the packing does not depend on Nproc
+	deque<size_t> pending (np);												// particles to be placed, in order
+	for (size_t i=0; i<np; ++i)	pending[i] = i;
+	vector<size_t> tries (np, 0);
+	vector<size_t> batch (nb);
+	vector<Vector3d> xc (nb);
+	vector<char> found (nb);
+	while (pending.size()>0)
+	{
+		size_t n = min(nb, pending.size());
+		for (size_t b=0; b<n; ++b)	batch[b] = pending[b];
+		pending.erase(pending.begin(), pending.begin()+n);
+		// find free positions against the current packing in parallel
+		#pragma omp parallel for schedule(dynamic, 8) num_threads(Nproc)
+		for (size_t b=0; b<n; ++b)
+		{
+			size_t i = batch[b];
+			double r = rs[i];
+			found[b] = 0;
+			while (tries[i]<maxTries)
+			{
+				uint64_t state = (Seed+0x9E3779B97F4A7C15ULL*(i+1))^(tries[i]*0xD1B54A32D192ED03ULL);
+				tries[i]++;
+				Vector3d x = X0;
+				for (size_t d=0; d<D; ++d)
+				{
+					double lo = X0(d)+r+Margin;
+					double hi = X1(d)-r-Margin;
+					x(d) = lo+(hi-lo)*Uniform01(state);
+				}
+				if (!Overlap(x, r, X.size()))
+				{
+					xc[b] = x;
+					found[b] = 1;
+					break;
+				}
+			}
+		}
+		// accept in order, candidates of the same batch may overlap each other and are tried again
+		vector<size_t> retry;
+		size_t nbfail = 0;
+		for (size_t b=0; b<n; ++b)
+		{
+			size_t i = batch[b];
+			if (found[b] && !Overlap(xc[b], rs[i], X.size()))
+			{
+				Add(xc[b], rs[i], tag);
+				InsertGrid(X.size()-1);
+				nadd++;
+			}
+			else if (found[b])	retry.push_back(i);
+			else				nbfail++;
+		}
+		nfail += nbfail;
+		// no particle of the batch could be placed, the packing is jammed
+		if (nbfail==n)	break;
+		// retries go first, before the particles of later batches
+		pending.insert(pending.begin(), retry.begin(), retry.end());
+	}
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now()-t_start).count();
+	if (nadd<np)	cout << "\033[1;33mWarning: RSA is close to the jamming limit, only " << nadd << " of " << np << " particles are added.\033[0m\n";
+	cout << "RSA added " << nadd << " particles in " << t << " s, solid fraction= " << SolidFraction() << endl;
+	return nadd;
+}
+
+inline size_t PACKING::PoissonDisk(int tag, size_t k)
+{
+	auto t_start = std::chrono::steady_clock::now();
+	BuildGrid();
+	size_t n0 = X.size();
+	uint64_t state = Seed;
+	vector<size_t> active;
+	// first particle at a random free position
+	for (size_t t=0; t<1000 && active.size()==0; ++t)
+	{
+		double r = SampleRadius(state);
+		Vector3d x = X0;
+		for (size_t d=0; d<D; ++d)	x(d) = X0(d)+r+Margin+(X1(d)-X0(d)-2.*(r+Margin))*Uniform01(state);
+		if (!Overlap(x, r, X.size()))
+		{
+			Add(x, r, tag);
+			InsertGrid(X.size()-1);
+			active.push_back(X.size()-1);
+		}
+	}
+	while (active.size()>0)
+	{
+		size_t a = (size_t) (Uniform01(state)*active.size());
+		if (a==active.size())	a--;
+		size_t p = active[a];
+		bool added = false;
+		for (size_t t=0; t<k; ++t)
+		{
+			double r = SampleRadius(state);
+			// random point in the shell [rs, 2rs] around particle p
+			double rs = R[p]+r+SurDis;
+			Vector3d n (0.,0.,0.);
+			if (D==2)
+			{
+				double phi = 2.*M_PI*Uniform01(state);
+				n << cos(phi), sin(phi), 0.;
+			}
+			else
+			{
+				double z = 2.*Uniform01(state)-1.;
+				double phi = 2.*M_PI*Uniform01(state);
+				double s = sqrt(1.-z*z);
+				n << s*cos(phi), s*sin(phi), z;
+			}
+			Vector3d x = X[p]+rs*(1.+Uniform01(state))*n;
+			bool inside = true;
+			for (size_t d=0; d<D; ++d)	if (x(d)<X0(d)+r+Margin || x(d)>X1(d)-r-Margin)	inside = false;
+			if (inside && !Overlap(x, r, X.size()))
+			{
+				Add(x, r, tag);
+				InsertGrid(X.size()-1);
+				active.push_back(X.size()-1);
+				added = true;
+				break;
+			}
+		}
+		if (!added)
+		{
+			active[a] = active.back();
+			active.pop_back();
+		}
+	}
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now()-t_start).count();
+	cout << "Poisson disk sampling added " << X.size()-n0 << " particles in " << t << " s, solid fraction= " << SolidFraction() << endl;
+	return X.size()-n0;
+}
+
+inline void PACKING::Settle(const Vector3d& dx, size_t nit, size_t nsweep)
+{
+	auto t_start = std::chrono::steady_clock::now();
+	size_t np = X.size();
+	vector<Vector3d> dxp (np);
+	for (size_t it=0; it<nit; ++it)
+	{
+		#pragma omp parallel for schedule(static) num_threads(Nproc)
+		for (size_t i=0; i<np; ++i)
+		{
+			X[i] += dx;
+			for (size_t d=0; d<D; ++d)	X[i](d) = max(X0(d)+R[i]+Margin, min(X[i](d), X1(d)-R[i]-Margin));
+		}
+		BuildGrid();
+		// Jacobi sweeps, each particle moves half of its overlaps away from the neighbours
+		for (size_t s=0; s<nsweep; ++s)
+		{
+			#pragma omp parallel for schedule(static) num_threads(Nproc)
+			for (size_t i=0; i<np; ++i)
+			{
+				dxp[i].setZero();
+				size_t c = CellIndex(X[i]);
+				int ci[3];
+				ci[2] = c%Nc(2);
+				ci[1] = (c/Nc(2))%Nc(1);
+				ci[0] = c/(Nc(1)*Nc(2));
+				for (int a=max(0,ci[0]-1); a<=min(Nc(0)-1,ci[0]+1); ++a)
+				for (int b=max(0,ci[1]-1); b<=min(Nc(1)-1,ci[1]+1); ++b)
+				for (int e=max(0,ci[2]-1); e<=min(Nc(2)-1,ci[2]+1); ++e)
+				{
+					for (long q=Head[(a*Nc(1)+b)*Nc(2)+e]; q!=-1; q=Next[q])
+					{
+						if ((size_t) q==i)	continue;
+						Vector3d xpq = X[i]-X[q];
+						double rs = R[i]+R[q]+SurDis;
+						double dis2 = xpq.squaredNorm();
+						if (dis2>=rs*rs || dis2==0.)	continue;
+						double dis = sqrt(dis2);
+						dxp[i] += 0.5*(rs-dis)/dis*xpq;
+					}
+				}
+			}
+			#pragma omp parallel for schedule(static) num_threads(Nproc)
+			for (size_t i=0; i<np; ++i)
+			{
+				X[i] += dxp[i];
+				for (size_t d=0; d<D; ++d)	X[i](d) = max(X0(d)+R[i]+Margin, min(X[i](d), X1(d)-R[i]-Margin));
+			}
+		}
+	}
+	BuildGrid();
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now()-t_start).count();
+	cout << "Settled " << np << " particles in " << t << " s" << endl;
+}
+
+inline double PACKING::SolidFraction()
+{
+	double vol = 1.;
+	for (size_t d=0; d<D; ++d)	vol *= X1(d)-X0(d);
+	double vs = 0.;
+	for (size_t i=0; i<R.size(); ++i)
+	{
+		if (D==2)	vs += M_PI*R[i]*R[i];
+		else		vs += 4./3.*M_PI*R[i]*R[i]*R[i];
+	}
+	return vs/vol;
+}
+
+inline void PACKING::WriteH5(string fname)
+{
+	size_t np = X.size();
+	H5File	file(fname, H5F_ACC_TRUNC);						//create a new hdf5 file.
+
+	hsize_t	dims_scalar[1] = {np};							//create data space.
+	hsize_t	dims_vector[1] = {3*np};						//create data space.
+
+	DataSpace	*space_scalar = new DataSpace(1, dims_scalar);
+	DataSpace	*space_vector = new DataSpace(1, dims_vector);
+
+	double* r_h5 	= new double[  np];
+	double* tag_h5 	= new double[  np];
+	double* pos_h5 	= new double[3*np];
+
+	for (size_t i=0; i<np; ++i)
+	{
+		r_h5  [  i  ] 	= R[i];
+		tag_h5[  i  ] 	= Tag[i];
+		pos_h5[3*i  ] 	= X[i](0);
+		pos_h5[3*i+1] 	= X[i](1);
+		pos_h5[3*i+2] 	= X[i](2);
+	}
+
+	DataSet	*dataset_r 		= new DataSet(file.createDataSet("Radius", PredType::NATIVE_DOUBLE, *space_scalar));
+	DataSet	*dataset_tag	= new DataSet(file.createDataSet("Tag", PredType::NATIVE_DOUBLE, *space_scalar));
+	DataSet	*dataset_pos	= new DataSet(file.createDataSet("Position", PredType::NATIVE_DOUBLE, *space_vector));
+
+	dataset_r->write(r_h5, PredType::NATIVE_DOUBLE);
+	dataset_tag->write(tag_h5, PredType::NATIVE_DOUBLE);
+	dataset_pos->write(pos_h5, PredType::NATIVE_DOUBLE);
+
+	delete space_scalar;
+	delete space_vector;
+	delete dataset_r;
+	delete dataset_tag;
+	delete dataset_pos;
+
+	delete[] r_h5;
+	delete[] tag_h5;
+	delete[] pos_h5;
+
+	file.close();
+	cout << "Packing of " << np << " particles is written to " << fname << endl;
+}
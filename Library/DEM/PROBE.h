@@ -0,0 +1,165 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Time series of selected (tracer) particles.
+// Records are kept in a fixed size buffer and appended to an HDF5 file when the buffer is full or Flush is called.
+// Layout of the file:
+// 	Label 		Np 			ID of each probed particle when it was added
+// 	Time 		Nt 			physical time of each record
+// 	State 		Nt x Np*21	X, V, W, Fh, Th, Fc, Tc of each probed particle (3 components each)
+// Removed particles are written as NaN.
+
+class DEM_PROBE
+{
+public:
+	DEM_PROBE();
+	void Add(size_t id);
+	void Record(double t, vector<DEM_PARTICLE*>& lp, size_t nproc);			// Copy the state of probed particles to the buffer
+	void Flush();															// Append buffered records to the file
+	void Remap(vector<size_t>& newID);										// Follow particles after Lp is reordered, newID = Removed for removed
+
+	static const size_t 			Ncol = 21;								// Values per particle per record
+	static const size_t 			Removed = numeric_limits<size_t>::max();	// Marks probed particles that were deleted
+	string 							FileName;
+	size_t 							BufferSize;								// Records kept in memory between two flushes
+	size_t 							Nrec;									// Records already in the file
+	vector<size_t> 					Lp;										// Current index of probed particles in DEM::Lp
+	vector<size_t> 					Label;
+	vector<double> 					Time;
+	vector<double> 					Data;
+	size_t 							Nb;										// Records in the buffer
+};
+
+inline DEM_PROBE::DEM_PROBE()
+{
+	FileName = "DEM_Probe.h5";
+	BufferSize = 1000;
+	Nrec = 0;
+	Nb = 0;
+}
+
+inline void DEM_PROBE::Add(size_t id)
+{
+	if (Nrec>0 || Nb>0)
+	{
+		cout << "\033[1;31mError: Probes can not be added after recording started.\033[0m\n";
+		exit(0);
+	}
+	if (find(Lp.begin(), Lp.end(), id)!=Lp.end())	return;
+	Lp.push_back(id);
+	Label.push_back(id);
+}
+
+inline void DEM_PROBE::Record(double t, vector<DEM_PARTICLE*>& lp, size_t nproc)
+{
+	if (Lp.size()==0)	return;
+	if (Time.size()!=BufferSize)
+	{
+		Time.resize(BufferSize);
+		Data.resize(BufferSize*Lp.size()*Ncol);
+	}
+	Time[Nb] = t;
+	double* d = &Data[Nb*Lp.size()*Ncol];
+	#pragma omp parallel for schedule(static) num_threads(nproc)
+	for (size_t i=0; i<Lp.size(); ++i)
+	{
+		double* di = d+i*Ncol;
+		if (Lp[i]==Removed)
+		{
+			for (size_t c=0; c<Ncol; ++c)	di[c] = numeric_limits<double>::quiet_NaN();
+			continue;
+		}
+		DEM_PARTICLE* p0 = lp[Lp[i]];
+		const Vector3d* v[7] = {&p0->X, &p0->V, &p0->W, &p0->Fh, &p0->Th, &p0->Fc, &p0->Tc};
+		for (size_t k=0; k<7; ++k)
+		for (size_t c=0; c<3; ++c)
+		{
+			di[3*k+c] = (*v[k])(c);
+		}
+	}
+	Nb++;
+	if (Nb==BufferSize)	Flush();
+}
+
+inline void DEM_PROBE::Flush()
+{
+	if (Nb==0)	return;
+	size_t ncol = Lp.size()*Ncol;
+	if (Nrec==0)
+	{
+		H5File file(FileName, H5F_ACC_TRUNC);
+
+		hsize_t dims_l[1] = {Label.size()};
+		DataSpace space_l(1, dims_l);
+		DataSet label = file.createDataSet("Label", PredType::NATIVE_ULONG, space_l);
+		vector<unsigned long> lab (Label.begin(), Label.end());
+		label.write(lab.data(), PredType::NATIVE_ULONG);
+
+		hsize_t dims_t[1] = {0};
+		hsize_t maxdims_t[1] = {H5S_UNLIMITED};
+		hsize_t chunk_t[1] = {BufferSize};
+		DSetCreatPropList prop_t;
+		prop_t.setChunk(1, chunk_t);
+		DataSpace space_t(1, dims_t, maxdims_t);
+		file.createDataSet("Time", PredType::NATIVE_DOUBLE, space_t, prop_t);
+
+		hsize_t dims_s[2] = {0, ncol};
+		hsize_t maxdims_s[2] = {H5S_UNLIMITED, ncol};
+		hsize_t chunk_s[2] = {min(BufferSize, max((size_t) 1, (size_t) (1<<20)/ncol)), ncol};
+		DSetCreatPropList prop_s;
+		prop_s.setChunk(2, chunk_s);
+		DataSpace space_s(2, dims_s, maxdims_s);
+		file.createDataSet("State", PredType::NATIVE_DOUBLE, space_s, prop_s);
+		file.close();
+	}
+
+	H5File file(FileName, H5F_ACC_RDWR);
+
+	DataSet time = file.openDataSet("Time");
+	hsize_t size_t1[1] = {Nrec+Nb};
+	time.extend(size_t1);
+	DataSpace fspace_t = time.getSpace();
+	hsize_t offset_t[1] = {Nrec};
+	hsize_t count_t[1] = {Nb};
+	fspace_t.selectHyperslab(H5S_SELECT_SET, count_t, offset_t);
+	DataSpace mspace_t(1, count_t);
+	time.write(Time.data(), PredType::NATIVE_DOUBLE, mspace_t, fspace_t);
+
+	DataSet state = file.openDataSet("State");
+	hsize_t size_s[2] = {Nrec+Nb, ncol};
+	state.extend(size_s);
+	DataSpace fspace_s = state.getSpace();
+	hsize_t offset_s[2] = {Nrec, 0};
+	hsize_t count_s[2] = {Nb, ncol};
+	fspace_s.selectHyperslab(H5S_SELECT_SET, count_s, offset_s);
+	DataSpace mspace_s(2, count_s);
+	state.write(Data.data(), PredType::NATIVE_DOUBLE, mspace_s, fspace_s);
+
+	file.close();
+	Nrec += Nb;
+	Nb = 0;
+}
+
+inline void DEM_PROBE::Remap(vector<size_t>& newID)
+{
+	for (size_t i=0; i<Lp.size(); ++i)
+	{
+		if (Lp[i]!=Removed)	Lp[i] = newID[Lp[i]];
+	}
+}
@@ -63,6 +63,8 @@ inline void DEMPM::Init()
     	// set DPs_proc for coupling
     	DomMPM->Ln[DomMPM->Ln.size()-1]->DPs_proc.resize(DomDEM->Nproc);
 	}
+	// Nodes above are dense, tiles only track where the MPM particles are
+	DomMPM->InitTiles();
 
 	DomDEM->Dt = 1.;
 	Vector3d x0 (0., 0., 0.);
@@ -180,7 +182,6 @@ inline void DEMPM::DEMtoNodeLocal(DEM_PARTICLE* p0)
 
 void DEMPM::DEMtoNode(bool show)
 {
-	auto t_start = std::chrono::system_clock::now();
 	// seperate Lc for openMP
 	vector<vector <size_t>> lans;
 	lans.resize(DomDEM->Nproc);
@@ -207,32 +208,37 @@ void DEMPM::DEMtoNode(bool show)
 				size_t p = p0->ID;
 
 				auto proc_id = omp_get_thread_num();
+				// a thread records a node only the first time it adds a particle to it
+				if (DomMPM->Ln[n]->DPs_proc[proc_id].size()==0)	lans[proc_id].push_back(n);
 				DomMPM->Ln[n]->DPs_proc[proc_id].push_back(p);
-				lans[proc_id].push_back(n);
 			}
 		}
 	}
-	auto t_end = std::chrono::system_clock::now();
-	if (show) 	cout << "000000000000000000= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		t_start = std::chrono::system_clock::now();
-	// remove repeated elements for Lc
+	// keep a node only in the list of the first thread which touched it, no sorting needed
 	#pragma omp parallel for schedule(static) num_threads(DomDEM->Nproc)
 	for (size_t n=0; n<DomDEM->Nproc; ++n)
 	{
-		sort( lans[n].begin(), lans[n].end() );
-		lans[n].erase(unique(lans[n].begin(), lans[n].end()), lans[n].end());
+		size_t nl = 0;
+		for (size_t l=0; l<lans[n].size(); ++l)
+		{
+			size_t id = lans[n][l];
+			bool first = true;
+			for (size_t m=0; m<n; ++m)
+			{
+				if (DomMPM->Ln[id]->DPs_proc[m].size()>0)
+				{
+					first = false;
+					break;
+				}
+			}
+			if (first)	lans[n][nl++] = id;
+		}
+		lans[n].resize(nl);
 	}
-	t_end = std::chrono::system_clock::now();
-	if (show)	cout << "+++++++++++++++++++++= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-	t_start = std::chrono::system_clock::now();
 	for (size_t n=0; n<DomDEM->Nproc; ++n)
 	{
 		LAn.insert( LAn.end(), lans[n].begin(), lans[n].end() );
 	}
-	sort( LAn.begin(), LAn.end() );
-	LAn.erase(unique(LAn.begin(), LAn.end()), LAn.end());
-	t_end = std::chrono::system_clock::now();
-	if (show)	cout << "//////////////////////= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
 	// cout << "2222222222" << endl;
 	if (show)	cout << "LAn= " << LAn.size() << endl;
 	// t_start = std::chrono::system_clock::now();
@@ -317,10 +323,10 @@ void DEMPM::FindDEMContact()
 
 void DEMPM::NodeToParticleWithDEM()
 {
-	auto t_start = std::chrono::system_clock::now();
 	// seperate Lc for openMP
 	vector<vector<vector <size_t>>> lcs;
 	lcs.resize(DomMPM->Nproc);
+	DomMPM->ResetGroups();
 	#pragma omp parallel for schedule(static) num_threads(DomMPM->Nproc)
 	for (size_t p=0; p<DomMPM->Lp.size(); ++p)
 	{
@@ -329,7 +335,7 @@ void DEMPM::NodeToParticleWithDEM()
 		DomMPM->Lp[p]->StressSmooth.setZero();
 		if (!DomMPM->Lp[p]->FixV)
 		{
-			for (size_t l=0; l<DomMPM->Lp[p]->Lni.size(); ++l)
+			for (size_t l=0; l<DomMPM->Lp[p]->Nn; ++l)
 			{
 				size_t 	id = DomMPM->Lp[p]->Lni[l];
 				double 	n  = DomMPM->Lp[p]->LnN[l];
@@ -354,19 +360,10 @@ void DEMPM::NodeToParticleWithDEM()
 		// CalPSizeCP(p);
 		// Update volume of particles
 		DomMPM->Lp[p]->Vol 	= DomMPM->Lp[p]->F.determinant()*DomMPM->Lp[p]->Vol0;
-		// Update strain
-		Matrix3d de = 0.5*DomMPM->Dt*(DomMPM->Lp[p]->L + DomMPM->Lp[p]->L.transpose());
-		// Update stress
+		// Rotate stress, the constitutive update is done by UpdateStress
 		Matrix3d w = 0.5*DomMPM->Dt*((DomMPM->Lp[p]->L - DomMPM->Lp[p]->L.transpose()));
 		DomMPM->Lp[p]->Stress += w*DomMPM->Lp[p]->Stress - DomMPM->Lp[p]->Stress*w.transpose();
-		if (DomMPM->Lp[p]->Type==0)			DomMPM->Lp[p]->Elastic(de);
-		else if (DomMPM->Lp[p]->Type==1)
-		{
-			DomMPM->Lp[p]->EOSMonaghan(DomMPM->Cs);
-			DomMPM->Lp[p]->Newtonian(de);
-		}
-		else if (DomMPM->Lp[p]->Type==2)	DomMPM->Lp[p]->MohrCoulomb(de);
-		else if (DomMPM->Lp[p]->Type==3)	DomMPM->Lp[p]->DruckerPrager(de);
+		DomMPM->GroupParticle(p);
 		// Reset hydro force and contact force
 		DomMPM->Lp[p]->Fh.setZero();
 		DomMPM->Lp[p]->Fc.setZero();
@@ -413,9 +410,7 @@ void DEMPM::NodeToParticleWithDEM()
 			}
 		}
 	}
-	auto t_end = std::chrono::system_clock::now();
-	// cout << "111111111111= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		t_start = std::chrono::system_clock::now();
+	DomMPM->UpdateStress();
 	// remove repeated elements for Lc
 	#pragma omp parallel for schedule(static) num_threads(DomMPM->Nproc)
 	for (size_t n=0; n<DomMPM->Nproc; ++n)
@@ -423,17 +418,12 @@ void DEMPM::NodeToParticleWithDEM()
 		sort( lcs[n].begin(), lcs[n].end() );
 		lcs[n].erase(unique(lcs[n].begin(), lcs[n].end()), lcs[n].end());
 	}
-	t_end = std::chrono::system_clock::now();
-	// cout << "2222222222= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-	t_start = std::chrono::system_clock::now();
 	for (size_t n=0; n<DomMPM->Nproc; ++n)
 	{
 		Lc.insert( Lc.end(), lcs[n].begin(), lcs[n].end() );
 	}
 	sort( Lc.begin(), Lc.end() );
-	Lc.erase(unique(Lc.begin(), Lc.end()), Lc.end());	
-	t_end = std::chrono::system_clock::now();	
-	// cout << "3333333333= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
+	Lc.erase(unique(Lc.begin(), Lc.end()), Lc.end());
 }
 
 void DEMPM::ContactDEMP()
@@ -457,6 +447,11 @@ void DEMPM::ContactDEMP()
 
 void DEMPM::Solve(int tt, int ts)
 {
+	if (DomMPM->APIC)
+	{
+		cout << "\033[1;31mError: APIC transfer is not supported by DEMPM, NodeToParticleWithDEM needs shape function gradients.\033[0m\n";
+		exit(0);
+	}
 	for (int t=0; t<tt; ++t)
 	{
 		bool show = false;
@@ -467,54 +462,51 @@ void DEMPM::Solve(int tt, int ts)
 		{
 			WriteFileH5(t);
 		}
-		if (show)	cout << "start contact" << endl;
-		ContactDEMP();
-		if (show)	cout << "finish contact" << endl;
-		Lc.clear();
-		if (show)	cout << "start move" << endl;
-		DomDEM->Move();
-		if (show)	cout << "finish move" << endl;
-		DomDEM->ZeroForceTorque(true, true);
-		for (size_t n=0; n<LAn.size(); ++n)
 		{
-			size_t id = LAn[n];
-			DomMPM->Ln[id]->ResetwithDEM(DomDEM->Nproc);
-	    }
-	    LAn.resize(0);
-	    if (show)	cout << "finish ZeroForceTorque" << endl;
+			PROFILE_SCOPE("DEMPM::ContactDEMP");
+			ContactDEMP();
+			Lc.clear();
+		}
+		{
+			PROFILE_SCOPE("DEMPM::DEMMove");
+			DomDEM->Move();
+			DomDEM->ZeroForceTorque(true, true);
+			for (size_t n=0; n<LAn.size(); ++n)
+			{
+				size_t id = LAn[n];
+				DomMPM->Ln[id]->ResetwithDEM(DomDEM->Nproc);
+		    }
+		    LAn.resize(0);
+		}
 		// cout << LAn.size() << endl;
-		// cout << "11111111111111111" << endl;
-		auto t_start = std::chrono::system_clock::now();
-		DomMPM->ParticleToNode();
-		auto t_end = std::chrono::system_clock::now();
-		if (show)	cout << "ParticleToNode= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		t_start = std::chrono::system_clock::now();
-		DomMPM->CalVOnNode();
-		t_end = std::chrono::system_clock::now();
-		if (show)	cout << "CalVOnNode= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		t_start = std::chrono::system_clock::now();
-		DEMtoNode(show);
-		t_end = std::chrono::system_clock::now();
-		// if (show)	cout << "finish DEMtoNode" << endl;
-		if (show)	cout << "DEMtoNode= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		t_start = std::chrono::system_clock::now();
-		FindDEMContact();
-		t_end = std::chrono::system_clock::now();
-		if (show)	cout << "FindDEMContact= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		t_start = std::chrono::system_clock::now();
-		DomDEM->Contact(false, 0);
-		int nc = DomDEM->Lc.size();
-		DomDEM->Lc.clear();
-		t_end = std::chrono::system_clock::now();
-		if (show)   cout << "nc= " << nc << endl;
-		if (show)	cout << "DEM Contact time= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		t_start = std::chrono::system_clock::now();
-		NodeToParticleWithDEM();
-		// if (Lc.size()>0) 	cout << "Lc.size()= " << Lc.size() << endl;
-		t_end = std::chrono::system_clock::now();
-		if (show)	cout << "NodeToParticle= " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << endl;
-		if (show) 	cout << "===========================" << endl;
+		{
+			PROFILE_SCOPE("DEMPM::ParticleToNode");
+			DomMPM->ParticleToNode();
+		}
+		{
+			PROFILE_SCOPE("DEMPM::CalVOnNode");
+			DomMPM->CalVOnNode();
+		}
+		{
+			PROFILE_SCOPE("DEMPM::DEMtoNode");
+			DEMtoNode(show);
+		}
+		{
+			PROFILE_SCOPE("DEMPM::FindDEMContact");
+			FindDEMContact();
+		}
+		{
+			PROFILE_SCOPE("DEMPM::DEMContact");
+			DomDEM->Contact(false, 0);
+			DomDEM->Lc.clear();
+		}
+		{
+			PROFILE_SCOPE("DEMPM::NodeToParticle");
+			NodeToParticleWithDEM();
+			// if (Lc.size()>0) 	cout << "Lc.size()= " << Lc.size() << endl;
+		}
 	}
+	PROFILE_WRITE("DEMPM_Profile");
 }
 
 inline void DEMPM::WriteFileH5(int n)
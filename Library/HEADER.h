@@ -11,6 +11,7 @@
 #include <stdexcept>
 #include <chrono>
 #include <unordered_map>
+#include <deque>
 #include <random>
 // #include <set>
 #include <H5Cpp.h>
@@ -22,3 +23,5 @@ using namespace std;
 using namespace Eigen;
 using namespace H5;
 
+#include "PROFILER.h"
+#include "MORTON.h"
@@ -0,0 +1,44 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Morton (Z-order) keys of cells, shared by the particle reordering of DEM and MPM.
+
+#ifndef MORTON_H
+#define MORTON_H
+
+// Spread the lower 21 bits of a so that there are two zero bits between each of them
+inline size_t SplitBy3(size_t a)
+{
+	size_t x = a & 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffff;
+	x = (x | x << 16) & 0x1f0000ff0000ff;
+	x = (x | x << 8 ) & 0x100f00f00f00f00f;
+	x = (x | x << 4 ) & 0x10c30c30c30c30c3;
+	x = (x | x << 2 ) & 0x1249249249249249;
+	return x;
+}
+
+// Morton (Z-order) code of a cell
+// https://en.wikipedia.org/wiki/Z-order_curve
+inline size_t MortonKey(size_t i, size_t j, size_t k)
+{
+	return SplitBy3(i) | SplitBy3(j) << 1 | SplitBy3(k) << 2;
+}
+
+#endif
@@ -94,7 +94,7 @@ inline void MPLBM::Solve(int tt, int ts)
 			Vector3d vf = DomLBM->InterpolateV(DomMPM->Lp[p]->X);
 			Vector3d vs = DomMPM->Lp[p]->V;
 			Vector3d mv = DomLBM->Rho0*DomMPM->Lp[p]->Vol*(vs-vf);
-			for (size_t l=0; l<DomMPM->Lp[p]->Lni.size(); ++l)
+			for (size_t l=0; l<DomMPM->Lp[p]->Nn; ++l)
 			{
 				size_t id = DomMPM->Lp[p]->Lni[l];
 		    	size_t i, j, k;
@@ -0,0 +1,228 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Fixed size kernels of the constitutive models.
+// Principal values are always sorted in descending order (s1>=s2>=s3), eigenvectors are the columns of v.
+// As SelfAdjointEigenSolver, the eigensolvers only read the lower triangle.
+
+#ifndef CONSTITUTIVE_H
+#define CONSTITUTIVE_H
+
+// Eigenvalues of a symmetric 3x3 matrix from the trigonometric solution of the characteristic polynomial
+inline Vector3d EigenValuesSym3(const Matrix3d& a)
+{
+	double p1 = a(1,0)*a(1,0)+a(2,0)*a(2,0)+a(2,1)*a(2,1);
+	if (p1==0.)
+	{
+		Vector3d s (a(0,0), a(1,1), a(2,2));
+		if (s(0)<s(1))	swap(s(0),s(1));
+		if (s(1)<s(2))	swap(s(1),s(2));
+		if (s(0)<s(1))	swap(s(0),s(1));
+		return s;
+	}
+	double q = a.trace()/3.;
+	double d0 = a(0,0)-q;
+	double d1 = a(1,1)-q;
+	double d2 = a(2,2)-q;
+	double p = sqrt((d0*d0+d1*d1+d2*d2+2.*p1)/6.);
+	// half of the determinant of (a-q*I)/p
+	double r = 0.5*(d0*(d1*d2-a(2,1)*a(2,1)) - a(1,0)*(a(1,0)*d2-a(2,1)*a(2,0)) + a(2,0)*(a(1,0)*a(2,1)-d1*a(2,0)))/(p*p*p);
+	r = min(max(r,-1.),1.);
+	double phi = acos(r)/3.;
+	Vector3d s;
+	s(0) = q+2.*p*cos(phi);
+	s(2) = q+2.*p*cos(phi+2.*M_PI/3.);
+	s(1) = 3.*q-s(0)-s(2);
+	return s;
+}
+
+// Eigenvalues and eigenvectors of a symmetric 3x3 matrix in closed form
+// The eigenvector of the best separated eigenvalue comes from cross products of the rows of a-s*I,
+// the other two from the 2x2 problem in its orthogonal complement, so repeated eigenvalues are handled without iterations.
+inline void EigenSym3(const Matrix3d& a, Vector3d& s, Matrix3d& v)
+{
+	s = EigenValuesSym3(a);
+	size_t i0 = (s(0)-s(1)>=s(1)-s(2))? 0:2;
+	Matrix3d b = a.selfadjointView<Lower>();
+	b.diagonal().array() -= s(i0);
+	Vector3d r01 = b.row(0).cross(b.row(1));
+	Vector3d r02 = b.row(0).cross(b.row(2));
+	Vector3d r12 = b.row(1).cross(b.row(2));
+	double d01 = r01.squaredNorm();
+	double d02 = r02.squaredNorm();
+	double d12 = r12.squaredNorm();
+	// a is a multiple of I, any basis will do
+	if (max(d01,max(d02,d12))==0.)
+	{
+		v.setIdentity();
+		return;
+	}
+	Vector3d e0;
+	if (d01>=d02 && d01>=d12)	e0 = r01/sqrt(d01);
+	else if (d02>=d12)			e0 = r02/sqrt(d02);
+	else						e0 = r12/sqrt(d12);
+	// orthonormal basis (u, w) of the complement of e0
+	Vector3d u;
+	if (abs(e0(0))>abs(e0(1)))	u = Vector3d(-e0(2), 0., e0(0))/sqrt(e0(0)*e0(0)+e0(2)*e0(2));
+	else						u = Vector3d(0., e0(2), -e0(1))/sqrt(e0(1)*e0(1)+e0(2)*e0(2));
+	Vector3d w = e0.cross(u);
+	// the remaining pair from one Jacobi rotation of the 2x2 projection, which stays accurate for (nearly) repeated eigenvalues
+	Vector3d au = a.selfadjointView<Lower>()*u;
+	Vector3d aw = a.selfadjointView<Lower>()*w;
+	double m00 = u.dot(au);
+	double m01 = u.dot(aw);
+	double m11 = w.dot(aw);
+	double c = 1.;
+	double sn = 0.;
+	if (m01!=0.)
+	{
+		double theta = 0.5*(m11-m00)/m01;
+		double t = 1./(abs(theta)+sqrt(theta*theta+1.));
+		if (theta<0.)	t = -t;
+		c = 1./sqrt(t*t+1.);
+		sn = t*c;
+		m00 -= t*m01;
+		m11 += t*m01;
+	}
+	Vector3d e1 = c*u-sn*w;
+	Vector3d e2 = sn*u+c*w;
+	// Rayleigh quotient refines the first eigenvalue as well
+	s << e0.dot(a.selfadjointView<Lower>()*e0), m00, m11;
+	v << e0, e1, e2;
+	// sort descending, move eigenvectors along
+	for (size_t i=0; i<2; ++i)
+	{
+		size_t k = i;
+		for (size_t j=i+1; j<3; ++j)	if (s(j)>s(k))	k = j;
+		if (k!=i)
+		{
+			swap(s(i),s(k));
+			v.col(i).swap(v.col(k));
+		}
+	}
+}
+
+// Mohr-Coulomb return mapping in principal stress space (non associated flow, no hardening)
+// sb are the sorted trial principal stresses and f>0 the trial yield function, returns the corrected principal stresses.
+inline Vector3d ReturnMohrCoulomb(const Vector3d& sb, double f, double sin0, double cos0, double sin1, double c, double k, double mu)
+{
+	double s1 = sb(0);
+	double s2 = sb(1);
+	double s3 = sb(2);
+
+	Vector3d sc;
+
+	double sin01 = sin0*sin1;
+	double qA0 = (8.*mu/3.-4.*k)*sin01;
+	double qA1 = mu*(1.+sin0)*(1.+sin1);
+	double qA2 = mu*(1.-sin0)*(1.-sin1);
+	double qB0 = 2.*c*cos0;
+
+	double gsl = 0.5*(s1-s2)/(mu*(1.+sin1));
+	double gsr = 0.5*(s2-s3)/(mu*(1.-sin1));
+	double gla = 0.5*(s1+s2-2.*s3)/(mu*(3.-sin1));
+	double gra = 0.5*(2.*s1-s2-s3)/(mu*(3.+sin1));
+
+	double qsA = qA0-4.*mu*(1.+sin01);
+	double qsB = f;
+
+	double qlA = qA0-qA1-2.*qA2;
+	double qlB = 0.5*(1.+sin0)*(s1+s2)-(1.-sin0)*s3-qB0;
+
+	double qrA = qA0-2.*qA1-qA2;
+	double qrB = (1.+sin0)*s1 - 0.5*(1.-sin0)*(s2+s3) - qB0;
+
+	double qaA = -4.*k*sin01;
+	double qaB = 2.*(s1+s2+s3)/3.*sin0 - qB0;
+
+	double minslsr = min(gsl,gsr);
+	double maxlara = max(gla,gra);
+
+	if (minslsr>0. && qsA*minslsr+qsB<0.)
+	{
+		// return to the plane
+		double dl = -qsB/qsA;
+		double ds0 = -dl*(2.*k-4.*mu/3.)*sin1;
+		sc(0) = s1+ds0-dl*(2.*mu*(1.+sin1));
+		sc(1) = s2+ds0;
+		sc(2) = s3+ds0+dl*(2.*mu*(1.-sin1));
+	}
+	else if (gsl>0. && gla>=gsl && qlA*gsl+qlB>=0. && qlA*gla+qlB<=0.)
+	{
+		// return left edge
+		double dl = -qlB/qlA;
+		double ds0 = dl*(4.*mu/3.-2.*k)*sin1;
+		sc(0) = sc(1) = 0.5*(s1+s2)+ds0 - dl*mu*(1.+sin1);
+		sc(2) = s3+ds0 + 2.*dl*mu*(1.-sin1);
+	}
+	else if (gsr>0. && gra>=gsr && qrA*gsr+qrB>=0. && qrA*gra+qrB<=0.)
+	{
+		// return right edge
+		double dl = -qrB/qrA;
+		double ds0 = dl*(4.*mu/3.-2.*k)*sin1;
+		sc(0) = s1 + ds0 - 2.*dl*mu*(1.+sin1);
+		sc(1) = sc(2) = 0.5*(s2+s3) + ds0 + dl*mu*(1.-sin1);
+	}
+	else if (maxlara>0. && qaA*maxlara+qaB>=-1.e-24)
+	{
+		// return to the apex
+		sc(0) = sc(1) = sc(2) = c*cos0/sin0;
+	}
+	else
+	{
+		cout << "undefined" << endl;
+		cout << s1 << " " << s2 << " " << s3 << endl;
+		cout << "minslsr:" << minslsr << endl;
+		cout << "qsA*minslsr+qsB: " << qsA*minslsr+qsB << endl;
+		cout << "===============" << endl;
+		cout << "gsl: " << gsl << endl;
+		cout << "gla: " << gla << endl;
+		cout << "qlA*gsl+qlB: " << qlA*gsl+qlB << endl;
+		cout << "qlA*gla+qlB: " << qlA*gla+qlB << endl;
+		cout << "===============" << endl;
+		cout << "gsr: " << gsr << endl;
+		cout << "gra: " << gra << endl;
+		cout << "qrA*gsr+qrB: " << qrA*gsr+qrB << endl;
+		cout << "qrA*gra+qrB: " << qrA*gra+qrB << endl;
+		cout << "===============" << endl;
+		cout << "maxlara " << maxlara << endl;
+		cout << "qaA*maxlara+qaB: " << qaA*maxlara+qaB << endl;
+		cout << "f: " << f << endl;
+		abort();
+	}
+	return sc;
+}
+
+// Drucker-Prager return mapping (cone or apex), p, ss and j2sqr are the pressure, deviator and sqrt(J2) of the trial stress
+// Returns the yield function of the corrected stress, evaluated from the scaled invariants instead of a new deviator.
+inline double ReturnDruckerPrager(Matrix3d& stress, double p, const Matrix3d& ss, double j2sqr, double f, double a, double b, double ad, double c, double k, double mu)
+{
+	if (a*(p-j2sqr/mu*k*ad)-b*c<0.)
+	{
+		// return to the cone
+		double dl = f/(mu+a*k*ad);
+		stress -= dl*(mu/j2sqr*ss+k*ad*Matrix3d::Identity());
+		return abs(j2sqr-dl*mu)+a*(p-dl*k*ad)-b*c;
+	}
+	// return to the apex
+	stress = b*c*Matrix3d::Identity();
+	return a*b*c-b*c;
+}
+
+#endif
@@ -19,6 +19,7 @@
 
 #include "../HEADER.h"
 #include <SHAPE.h>
+#include <CONSTITUTIVE.h>
 #include <MPM_PARTICLE.h>
 #include <MPM_NODE.h>
 
@@ -29,14 +30,37 @@ public:
 	~MPM();
 	MPM(size_t ntype, size_t nx, size_t ny, size_t nz, Vector3d dx);
 	void Init();
+	void InitTiles();																		// Tile table of the background grid, nodes are allocated on touch
+	void AllocateTile(size_t t);
+	void ReleaseTile(size_t t);
+	void ActivateTiles();																	// Allocate tiles covered by particles and recycle tiles left by them
+	size_t TileIndex(size_t n);
+	MPM_NODE* KeepNode(size_t n);															// Allocate the tile of node n and never recycle it
 	void UpdateLn(MPM_PARTICLE* p0);
 	void CalNGN(MPM_PARTICLE* p0);
+	template<int DIM, int T>
+	void CalNGNT(MPM_PARTICLE* p0);																// CalNGN for dimension DIM and shape function type T
 	void CalNGN_MLS(MPM_PARTICLE* p0);
 	void UpdateLAn();
+	void SortParticles();																	// Reorder Lp by tile and cell for locality
+	void BinParticles();																	// Sort particle indices by colour and block of the grid
+	void ScatterParticle(MPM_PARTICLE* p0);												// Add mass, momentum, force and stress of a particle to its nodes
+	void ScatterParticleAPIC(MPM_PARTICLE* p0);											// ScatterParticle with affine momentum, stress enters through the same weights
+	void GatherParticleAPIC(MPM_PARTICLE* p0);												// Velocity, position and affine matrix of a particle from its nodes
 	void ParticleToNode();
+	void ScatterParticleMLS(MPM_PARTICLE* p0);												// Add mass and force of a particle to its nodes and register it for the MLS fit
+	template<int DIM>
+	Vector3d FitMLS(MPM_NODE* n0);
 	void ParticleToNodeMLS();
 	void CalFOnNode(bool firstStep);
 	void NodeToParticle();
+	template<void (*K)(MPM_PARTICLE*, Matrix3d&, double)>
+	void RegisterModel(int type);															// Use kernel K for the stress update of particles of this Type
+	template<void (*K)(MPM_PARTICLE*, Matrix3d&, double)>
+	void UpdateStressGroup(vector<size_t>& lg);											// Run kernel K over one material group
+	void ResetGroups();
+	void GroupParticle(size_t p);															// Add particle p to the group of its Type (called by one thread per particle)
+	void UpdateStress();																	// Stress update of all groups, material by material
 	void CalStressOnParticleElastic();
 	void CalStressOnParticleMohrCoulomb();
 	void CalStressOnParticleNewtonian();
@@ -66,14 +90,24 @@ public:
 	double 		(*N)(Vector3d& x, Vector3d& xc, Vector3d& l, Vector3d& lp);
 	Vector3d 	(*GN)(Vector3d& x, Vector3d& xc, Vector3d& l, Vector3d& lp);
 	void 		(*NGN)(Vector3d& x, Vector3d& xc, Vector3d& l, Vector3d& lp, double& n, Vector3d& gn);
+	void 		(MPM::*CalNGNP)(MPM_PARTICLE* p0);														// Specialisation of CalNGNT chosen by the constructor
+	vector <void (MPM::*)(vector<size_t>&)>	Models;									// Stress update of each particle Type, NULL if the Type has none
 
 	vector <size_t>					LAn;													// List of actived nodes
 	vector <MPM_PARTICLE*>			Lp;														// List of all MPM particles
 	vector <MPM_PARTICLE*>			Lbp;													// List of boundary MPM particles
-	vector <MPM_NODE*>				Ln;														// List of all MPM nodes
+	vector <MPM_NODE*>				Ln;														// List of all MPM nodes, NULL if the tile of the node is not allocated
+	vector <MPM_TILE>				Lt;														// List of all tiles
+	vector <size_t>					LAt;													// List of allocated tiles
+	vector <size_t>					Lpb;													// Particle indices sorted by colour and block
+	vector <size_t>					Bstart;													// Start of each block in Lpb
+	vector <vector<size_t> >		Lg;														// Particle indices of each material group (Type)
+	vector <vector<vector<size_t> > >	Lgp;												// Per thread material groups, merged into Lg by UpdateStress
 
 	bool							Periodic[3];
 	bool 							MLSv;
+	bool 							APIC;													// MLS-MPM/APIC transfer in ParticleToNode and NodeToParticle, B-spline shape functions only
+	bool 							SortMorton;												// Order tiles along a Morton curve in SortParticles, otherwise row by row
 
     size_t 							Nx;														// Domain size
     size_t 							Ny;
@@ -81,16 +115,26 @@ public:
     size_t 							Ncz;
     size_t 							Ncy;
     size_t 							Nnode;													// Total number of nodes
+    size_t 							Bsize;													// Size (cells) of blocks for binning particles
+    size_t 							Nb[3];													// Number of blocks in each direction
+    size_t 							Nt[3];													// Number of tiles in each direction
+    size_t 							Ntn;													// Number of nodes in a tile
+    size_t 							TileLife;												// Steps an untouched tile stays allocated
+    size_t 							SortInterval;											// Calls of ParticleToNode between two reorderings of Lp, 0 for never
+    size_t 							Nunsorted;												// Calls of ParticleToNode since the last reordering
+    static const size_t 			Ts = 4;													// Size (nodes) of tiles in each direction
 
     size_t 							Nproc;
     size_t 							D;														// Dimension	
     size_t 							Ntype;													// Type of shape function 0 for Linear, 1 for Quadratic and 2 for Cubic 3 for GIMP
+    size_t 							Ns;														// Max number of nodes in the stencil of a particle
 
     double 							Nrange;													// Influence range of shape function
     double 							Dt;														// Time step
     double 							Dc;														// Damping coefficient
     double 							Cs;														// Speed of sound
     Vector3d						Dx;														// Space step
+    Vector3d						Dinv;													// Inverse of the (diagonal) inertia tensor D of APIC for B-splines
 };
 
 MPM::MPM(size_t ntype, size_t nx, size_t ny, size_t nz, Vector3d dx)
@@ -112,6 +156,21 @@ MPM::MPM(size_t ntype, size_t nx, size_t ny, size_t nz, Vector3d dx)
 	Periodic[2] = false;
 
 	MLSv = false;
+	APIC = false;
+	Bsize = 4;
+	Nb[0] = Nb[1] = Nb[2] = 1;
+	Nt[0] = Nt[1] = Nt[2] = 1;
+	Ntn = 1;
+	TileLife = 100;
+	SortInterval = 0;
+	Nunsorted = 0;
+	SortMorton = false;
+
+	RegisterModel<ModelElastic>(0);
+	RegisterModel<ModelNewtonian>(1);
+	RegisterModel<ModelMohrCoulomb>(2);
+	RegisterModel<ModelDruckerPrager>(3);
+	RegisterModel<ModelGranular>(5);
 
 	Ncz = (Nx+1)*(Ny+1);
 	Ncy = (Nx+1);
@@ -123,57 +182,206 @@ MPM::MPM(size_t ntype, size_t nx, size_t ny, size_t nz, Vector3d dx)
 		D = 2;
 		if (Ny==0)	D = 1;
 	}
+	// D of APIC is only constant for B-splines, it stays zero for other shape functions
+	Dinv.setZero();
 	// Linear
 	if 		(Ntype == 0)
 	{
-		if (D==1) 			NGN =& LS1D;
-		else if (D==2)		NGN =& LS2D;
-		else if (D==3)		NGN =& LS3D;
-		else
-		{
-			cout << "Dimension is higher than 3." << endl;
-			abort();
-		}
+		if (D==1) 			{NGN = &NGNT<1,0>;	CalNGNP = &MPM::CalNGNT<1,0>;}
+		else if (D==2)		{NGN = &NGNT<2,0>;	CalNGNP = &MPM::CalNGNT<2,0>;}
+		else 				{NGN = &NGNT<3,0>;	CalNGNP = &MPM::CalNGNT<3,0>;}
 		Nrange 	= 1.;
 		cout << "Using Linear shape function." << endl;
 	}
+	// Quadratic B-spline
+	else if (Ntype == 1)
+	{
+		if (D==1) 			{NGN = &NGNT<1,1>;	CalNGNP = &MPM::CalNGNT<1,1>;}
+		else if (D==2)		{NGN = &NGNT<2,1>;	CalNGNP = &MPM::CalNGNT<2,1>;}
+		else 				{NGN = &NGNT<3,1>;	CalNGNP = &MPM::CalNGNT<3,1>;}
+		Nrange 	= 1.5;
+		for (size_t d=0; d<D; ++d)	Dinv(d) = 4./(Dx(d)*Dx(d));
+		cout << "Using Quadratic B-spline shape function." << endl;
+	}
+	// Cubic B-spline
+	else if (Ntype == 2)
+	{
+		if (D==1) 			{NGN = &NGNT<1,2>;	CalNGNP = &MPM::CalNGNT<1,2>;}
+		else if (D==2)		{NGN = &NGNT<2,2>;	CalNGNP = &MPM::CalNGNT<2,2>;}
+		else 				{NGN = &NGNT<3,2>;	CalNGNP = &MPM::CalNGNT<3,2>;}
+		Nrange 	= 2.;
+		for (size_t d=0; d<D; ++d)	Dinv(d) = 3./(Dx(d)*Dx(d));
+		cout << "Using Cubic B-spline shape function." << endl;
+	}
 	// GIMP
 	else if (Ntype == 3)
 	{
-		if (D==1)			NGN =& GIMP1D;
-		else if (D==2) 		NGN =& GIMP2D;
-		else if (D==3)		NGN =& GIMP3D;
-		else
-		{
-			cout << "Dimension is higher than 3." << endl;
-			abort();
-		}
+		if (D==1) 			{NGN = &NGNT<1,3>;	CalNGNP = &MPM::CalNGNT<1,3>;}
+		else if (D==2)		{NGN = &NGNT<2,3>;	CalNGNP = &MPM::CalNGNT<2,3>;}
+		else 				{NGN = &NGNT<3,3>;	CalNGNP = &MPM::CalNGNT<3,3>;}
 		Nrange 	= 1.;
 		cout << "Using GIMP shape function." << endl;
 	}
 	else
 	{
-		cout << "Undefined shape function type. Retry 0 for Linear, 1 for Quadratic and 2 for Cubic." << endl;
+		cout << "Undefined shape function type. Retry 0 for Linear, 1 for Quadratic, 2 for Cubic and 3 for GIMP." << endl;
 		abort();
 	}
+	// Nodes per direction of the stencil, GIMP particles reach up to 4 nodes
+	size_t nd = (Ntype==0) ? 2 : (Ntype==1) ? 3 : 4;
+	Ns = 1;
+	for (size_t d=0; d<D; ++d)	Ns *= nd;
 }
 
 void MPM::Init()
 {
 	cout << "================ Start init.  ================" << endl;
 	Lp.resize(0);
-	Ln.resize(0);
-	// Add basic nodes
-	for (size_t n=0; n<(Nx+1)*(Ny+1)*(Nz+1); ++n)
+	// Nodes are created tile by tile when particles or boundary conditions need them
+	Ln.assign(Nnode, NULL);
+	InitTiles();
+	cout << "=============== Finish init.  ================" << endl;
+}
+
+void MPM::InitTiles()
+{
+	size_t n[3] = {Nx, Ny, Nz};
+	Ntn = 1;
+	for (size_t d=0; d<3; ++d)
 	{
-    	size_t i, j, k;
-    	FindIndex(n, i, j, k);
-		Vector3d x (i, j, k);
-		Ln.push_back(new MPM_NODE(0,x));
-    	Ln[Ln.size()-1]->ID = Ln.size()-1;
+		Nt[d] = n[d]/Ts+1;
+		if (d<D)	Ntn *= Ts;
+	}
+	Lt.assign(Nt[0]*Nt[1]*Nt[2], MPM_TILE());
+	LAt.resize(0);
+}
+
+// Nodes of a tile are contiguous in memory, nodes out of the domain are left unused
+void MPM::AllocateTile(size_t t)
+{
+	MPM_TILE* t0 = &Lt[t];
+	t0->Allocated = true;
+	t0->Idle = 0;
+	size_t i0 = (t%Nt[0])*Ts;
+	size_t j0 = ((t/Nt[0])%Nt[1])*Ts;
+	size_t k0 = (t/(Nt[0]*Nt[1]))*Ts;
+	// Nodes created by a coupled domain (e.g. DEMPM) are used as they are
+	if (Ln[i0+j0*Ncy+k0*Ncz]!=NULL)	return;
+	t0->Nodes = new MPM_NODE[Ntn];
+	for (size_t c=0; c<(D>2 ? Ts : 1); ++c)
+	for (size_t b=0; b<(D>1 ? Ts : 1); ++b)
+	for (size_t a=0; a<Ts; ++a)
+	{
+		size_t i = i0+a, j = j0+b, k = k0+c;
+		if (i>Nx || j>Ny || k>Nz)	continue;
+		size_t id = i+j*Ncy+k*Ncz;
+		MPM_NODE* n0 = &t0->Nodes[a+(b+c*Ts)*Ts];
+		n0->X = Vector3d(i, j, k);
+		n0->ID = id;
+		Ln[id] = n0;
+	}
+}
+
+void MPM::ReleaseTile(size_t t)
+{
+	MPM_TILE* t0 = &Lt[t];
+	t0->Allocated = false;
+	if (t0->Nodes==NULL)	return;
+	for (size_t l=0; l<Ntn; ++l)
+	{
+		if (Ln[t0->Nodes[l].ID]==&t0->Nodes[l])	Ln[t0->Nodes[l].ID] = NULL;
+	}
+	delete [] t0->Nodes;
+	t0->Nodes = NULL;
+}
+
+inline size_t MPM::TileIndex(size_t n)
+{
+	size_t i, j, k;
+	FindIndex(n, i, j, k);
+	return i/Ts + (j/Ts)*Nt[0] + (k/Ts)*Nt[0]*Nt[1];
+}
+
+MPM_NODE* MPM::KeepNode(size_t n)
+{
+	size_t t = TileIndex(n);
+	if (!Lt[t].Allocated)
+	{
+		AllocateTile(t);
+		LAt.push_back(t);
+	}
+	Lt[t].Keep = true;
+	return Ln[n];
+}
+
+// The influence range is widened by half a cell so that it also covers CalNGN_MLS.
+// A tile is recorded by the thread which first flags it, so the cost is proportional to the number of active tiles, not to the domain size.
+// Tiles are released only after TileLife steps without particles, to avoid reallocating tiles at the edge of the material every step.
+void MPM::ActivateTiles()
+{
+	for (size_t l=0; l<LAt.size(); ++l)	Lt[LAt[l]].Touched = 0;
+	size_t n[3] = {Nx, Ny, Nz};
+	vector<vector <size_t>> lts;
+	lts.resize(Nproc);
+	#pragma omp parallel for schedule(static) num_threads(Nproc)
+	for (size_t p=0; p<Lp.size(); ++p)
+	{
+		auto id = omp_get_thread_num();
+		size_t tmin[3] = {0, 0, 0};
+		size_t tmax[3] = {0, 0, 0};
+		for (size_t d=0; d<D; ++d)
+		{
+			double r = Lp[p]->PSize(d)+Nrange+0.5;
+			tmin[d] = min((size_t) max(0., ceil(Lp[p]->X(d)-r)), n[d])/Ts;
+			tmax[d] = min((size_t) max(0., Lp[p]->X(d)+r), n[d])/Ts;
+		}
+		for (size_t k=tmin[2]; k<=tmax[2]; ++k)
+		for (size_t j=tmin[1]; j<=tmax[1]; ++j)
+		for (size_t i=tmin[0]; i<=tmax[0]; ++i)
+		{
+			size_t t = i + j*Nt[0] + k*Nt[0]*Nt[1];
+			unsigned char touched;
+			#pragma omp atomic capture
+			{touched = Lt[t].Touched; Lt[t].Touched = 1;}
+			if (touched==0)	lts[id].push_back(t);
+		}
+	}
+	// Age and recycle allocated tiles
+	size_t nat = 0;
+	for (size_t l=0; l<LAt.size(); ++l)
+	{
+		size_t t = LAt[l];
+		MPM_TILE* t0 = &Lt[t];
+		if (t0->Touched)	t0->Idle = 0;
+		else
+		{
+			t0->Idle++;
+			if (t0->Idle>TileLife && !t0->Keep)
+			{
+				ReleaseTile(t);
+				continue;
+			}
+		}
+		LAt[nat++] = t;
+	}
+	LAt.resize(nat);
+	// Allocate new tiles, in ascending order so that the memory layout does not depend on Nproc
+	vector<size_t> lnt;
+	for (size_t i=0; i<Nproc; ++i)
+	{
+		for (size_t l=0; l<lts[i].size(); ++l)
+		{
+			if (!Lt[lts[i][l]].Allocated)	lnt.push_back(lts[i][l]);
+		}
+	}
+	sort(lnt.begin(), lnt.end());
+	for (size_t l=0; l<lnt.size(); ++l)
+	{
+		AllocateTile(lnt[l]);
+		LAt.push_back(lnt[l]);
 	}
-	cout << "=============== Finish init.  ================" << endl;
 }
+
 // Find index for grid
 inline void MPM::FindIndex(size_t n, size_t& i, size_t& j, size_t& k)
 {
@@ -182,47 +390,249 @@ inline void MPM::FindIndex(size_t n, size_t& i, size_t& j, size_t& k)
 	i = (n%Ncz)%Ncy;
 }
 
-void MPM::CalNGN(MPM_PARTICLE* p0)
+inline void MPM::CalNGN(MPM_PARTICLE* p0)
 {
-	// Reset shape function (N) and gradient of shape function (GN)
-	p0->Lni.resize(0);
-	p0->LnN.resize(0);
-	p0->LnGN.resize(0);
-	// Find min position of nodes which is infuenced by this particle
-	Vector3i minx 	= Vector3i::Zero();
-	Vector3i maxx 	= Vector3i::Zero();
+	(this->*CalNGNP)(p0);
+}
+
+// Shape functions are products of 1D factors, which are computed once per direction and node
+// Nodes out of the grid are skipped, so particles at the boundary never reach an index of another row or an unallocated tile.
+template<int DIM, int T>
+void MPM::CalNGNT(MPM_PARTICLE* p0)
+{
+	int 	nmax[3] 	= {(int) Nx, (int) Ny, (int) Nz};
+	size_t 	ni[3] 		= {1, 1, 1};								// Number of nodes in each direction
+	int 	i0[3] 		= {0, 0, 0};								// First node in each direction, the influenced nodes are contiguous
+	double 	n1[3][4] 	= {{1.}, {1.}, {1.}};						// 1D shape functions
+	double 	gn1[3][4] 	= {{0.}, {0.}, {0.}};						// 1D gradients of shape functions
+	for (int d=0; d<DIM; ++d)
+	{
+		// Find nodes within the influence range
+		int maxx = min((int) trunc(p0->X(d) + p0->PSize(d) + ShapeRange<T>()), nmax[d]);
+		int minx = max((int) ceil(p0->X(d) - p0->PSize(d) - ShapeRange<T>()), 0);
+		ni[d] = 0;
+		for (int i=minx; i<=maxx; ++i)
+		{
+			double n, gn;
+			Shape1D<T>(p0->X(d), (double) i, Dx(d), p0->PSize(d), n, gn);
+			if (n>0.)
+			{
+				if (ni[d]==4)
+				{
+					cout << "\033[1;31mError: More than 4 nodes in one direction are influenced by particle " << p0->ID << ".\033[0m\n";
+					exit(0);
+				}
+				if (ni[d]==0)	i0[d] = i;
+				n1[d][ni[d]] = n;
+				gn1[d][ni[d]] = gn;
+				ni[d]++;
+			}
+		}
+	}
+	// Stencil arrays are sized on first use only
+	if (p0->Lni.size()<Ns)	p0->SetStencilSize(Ns);
+	// Tensor product
+	p0->Nn = 0;
+	for (size_t k=0; k<ni[2]; ++k)
+	for (size_t j=0; j<ni[1]; ++j)
+	{
+		double njk 	= n1[1][j]*n1[2][k];
+		double gjk1 = gn1[1][j]*n1[2][k];
+		double gjk2 = n1[1][j]*gn1[2][k];
+		size_t idjk = (i0[1]+j)*Ncy + (i0[2]+k)*Ncz;
+		for (size_t i=0; i<ni[0]; ++i)
+		{
+			size_t l = p0->Nn++;
+			p0->Lni[l] 		= i0[0] + i + idjk;
+			p0->LnN[l] 		= n1[0][i]*njk;
+			// APIC needs no gradients
+			if (APIC)	continue;
+			p0->LnGN[l](0) 	= gn1[0][i]*njk;
+			p0->LnGN[l](1) 	= n1[0][i]*gjk1;
+			p0->LnGN[l](2) 	= (DIM>2) ? n1[0][i]*gjk2 : 0.;
+		}
+	}
+}
+
+// Particles are ordered by tile and by cell inside a tile, so particles sharing nodes are close in Lp and in memory.
+// Keys are counted over allocated tiles only, and particles are copied to new objects in the new order.
+// IDs are reset to the new indices, Lbp keeps pointing to the same particles.
+void MPM::SortParticles()
+{
+	vector<size_t> lat (LAt.begin(), LAt.end());
+	if (SortMorton)
+	{
+		vector< pair<size_t, size_t> > lk (lat.size());						// Morton key and tile
+		for (size_t l=0; l<lat.size(); ++l)
+		{
+			size_t t = lat[l];
+			lk[l] = make_pair(MortonKey(t%Nt[0], (t/Nt[0])%Nt[1], t/(Nt[0]*Nt[1])), t);
+		}
+		sort(lk.begin(), lk.end());
+		for (size_t l=0; l<lat.size(); ++l)	lat[l] = lk[l].second;
+	}
+	else	sort(lat.begin(), lat.end());
+	vector<size_t> rank (Lt.size(), 0);
+	for (size_t l=0; l<lat.size(); ++l)	rank[lat[l]] = l;
+
+	size_t n[3] = {Nx, Ny, Nz};
+	vector<size_t> key (Lp.size());
+	#pragma omp parallel for schedule(static) num_threads(Nproc)
+	for (size_t p=0; p<Lp.size(); ++p)
+	{
+		size_t c[3] = {0, 0, 0};
+		for (size_t d=0; d<D; ++d)	c[d] = min((size_t) max(0., Lp[p]->X(d)), n[d]);
+		size_t t = c[0]/Ts + (c[1]/Ts)*Nt[0] + (c[2]/Ts)*Nt[0]*Nt[1];
+		key[p] = rank[t]*Ntn + c[0]%Ts + (c[1]%Ts + (c[2]%Ts)*Ts)*Ts;
+	}
+	// Counting sort, particles in a cell stay in the order of ID
+	vector<size_t> start (lat.size()*Ntn+1, 0);
+	for (size_t p=0; p<Lp.size(); ++p)		start[key[p]+1]++;
+	for (size_t k=0; k+1<start.size(); ++k)	start[k+1] += start[k];
+	vector<size_t> newID (Lp.size());
+	for (size_t p=0; p<Lp.size(); ++p)		newID[p] = start[key[p]]++;
+
+	vector <MPM_PARTICLE*> Lpt (Lp.size());
+	for (size_t p=0; p<Lp.size(); ++p)
+	{
+		Lpt[newID[p]] = new MPM_PARTICLE(*Lp[p]);
+		Lpt[newID[p]]->ID = newID[p];
+	}
+	for (size_t l=0; l<Lbp.size(); ++l)	Lbp[l] = Lpt[newID[Lbp[l]->ID]];
+	for (size_t p=0; p<Lp.size(); ++p)	delete Lp[p];
+	Lp = Lpt;
+}
+
+// Blocks whose indices have the same parity in every direction (same colour) are at least one block apart.
+// With Bsize larger than twice the reach of particles they share no nodes.
+void MPM::BinParticles()
+{
+	double rmax = 0.;
+	for (size_t p=0; p<Lp.size(); ++p)
 	for (size_t d=0; d<D; ++d)
 	{
-		maxx(d) = (int) trunc(p0->X(d) + p0->PSize(d) + 1.);
-		minx(d) = (int) ceil(p0->X(d) - p0->PSize(d) - 1.);
+		rmax = max(rmax, Lp[p]->PSize(d));
+	}
+	size_t r = (size_t) ceil(rmax+Nrange);
+	Bsize = max((size_t) 4, 2*r+1);
+	size_t n[3] = {Nx, Ny, Nz};
+	for (size_t d=0; d<3; ++d)	Nb[d] = (d<D) ? n[d]/Bsize+1 : 1;
+	size_t nb = Nb[0]*Nb[1]*Nb[2];
+	size_t nc = 1<<D;
+
+	vector<size_t> key (Lp.size());
+	#pragma omp parallel for schedule(static) num_threads(Nproc)
+	for (size_t p=0; p<Lp.size(); ++p)
+	{
+		size_t b[3] = {0, 0, 0};
+		for (size_t d=0; d<D; ++d)	b[d] = min(((size_t) max(0., Lp[p]->X(d)))/Bsize, Nb[d]-1);
+		size_t c = b[0]%2 + 2*(b[1]%2) + 4*(b[2]%2);
+		key[p] = c*nb + b[0] + b[1]*Nb[0] + b[2]*Nb[0]*Nb[1];
 	}
+	// Counting sort, particles in a block stay in the order of ID
+	Bstart.assign(nc*nb+1, 0);
+	for (size_t p=0; p<Lp.size(); ++p)	Bstart[key[p]+1]++;
+	for (size_t b=0; b<nc*nb; ++b)		Bstart[b+1] += Bstart[b];
+	vector<size_t> pos (Bstart.begin(), Bstart.end()-1);
+	Lpb.resize(Lp.size());
+	for (size_t p=0; p<Lp.size(); ++p)	Lpb[pos[key[p]]++] = p;
+}
 
-	// Find nodes within the influence range
-	for (int i=minx(0); i<=maxx(0); ++i)
-	for (int j=minx(1); j<=maxx(1); ++j)
-	for (int k=minx(2); k<=maxx(2); ++k)
+void MPM::ScatterParticle(MPM_PARTICLE* p0)
+{
+	Matrix3d vsp = -p0->Vol*p0->Stress;
+	Vector3d fex = p0->M*p0->B + p0->Fh + p0->Fc;
+
+	for (size_t l=0; l<p0->Nn; ++l)
 	{
-		double n;
-		Vector3d gn;
-		Vector3d xn (i,j,k);
-		NGN(p0->X, xn, Dx, p0->PSize, n, gn);
-		// Find id of current node
-		int id = i+j*Ncy+k*Ncz;
-		if (n>0.)
+		// Grid id
+		size_t id = p0->Lni[l];
+		// weight
+		double 		n 	= p0->LnN[l];
+		Vector3d 	gn 	= p0->LnGN[l];
+		Vector3d 	df 	= n*fex + vsp*gn;
+		// weigthed mass contribution
+		double nm = n*p0->M;
+		MPM_NODE* n0 = Ln[id];
+		n0->Actived = true;
+		n0->M += nm;
+		for (size_t d=0; d<D; ++d)
 		{
-			p0->Lni.push_back(id);
-			p0->LnN.push_back(n);
-			p0->LnGN.push_back(gn);
+			n0->Mv(d) += nm*p0->V(d);
+			n0->F(d) += df(d);
+			n0->Mv(d) += df(d)*Dt;
+			// smooth stress on node
+			for (size_t c=0; c<D; ++c)
+			{
+				n0->Stress(d,c) += nm*p0->Stress(d,c);
+			}
 		}
-		// #pragma omp critical
-		// {
-		// 	Ln[id]->MPs.push_back(p0->ID);
-		// }
 	}
 }
 
+// MLS-MPM (Hu et al. 2018): the gradient of the shape function is replaced by N*Dinv*(xi-xp),
+// so the internal force and the affine momentum of APIC are added with the same weights in one pass.
+void MPM::ScatterParticleAPIC(MPM_PARTICLE* p0)
+{
+	Matrix3d q = -p0->Vol*p0->Stress*Dinv.asDiagonal();
+	Matrix3d mc = p0->M*p0->Af;
+	Vector3d fex = p0->M*p0->B + p0->Fh + p0->Fc;
+
+	for (size_t l=0; l<p0->Nn; ++l)
+	{
+		size_t id = p0->Lni[l];
+		double n = p0->LnN[l];
+		MPM_NODE* n0 = Ln[id];
+		Vector3d dx = n0->X - p0->X;
+		Vector3d df = n*(fex + q*dx);
+		Vector3d dmv = n*(p0->M*p0->V + mc*dx) + df*Dt;
+		double nm = n*p0->M;
+		n0->Actived = true;
+		n0->M += nm;
+		for (size_t d=0; d<D; ++d)
+		{
+			n0->Mv(d) += dmv(d);
+			n0->F(d) += df(d);
+			for (size_t c=0; c<D; ++c)
+			{
+				n0->Stress(d,c) += nm*p0->Stress(d,c);
+			}
+		}
+	}
+}
+
+// Velocity is interpolated (PIC) and the affine matrix Af=sum(N*vi*(xi-xp)^T)*Dinv gives the velocity gradient.
+// L is stored transposed as in CalVGradLocal.
+void MPM::GatherParticleAPIC(MPM_PARTICLE* p0)
+{
+	Vector3d v = Vector3d::Zero();
+	Matrix3d b = Matrix3d::Zero();
+	for (size_t l=0; l<p0->Nn; ++l)
+	{
+		size_t id = p0->Lni[l];
+		double n = p0->LnN[l];
+		MPM_NODE* n0 = Ln[id];
+		Vector3d nv = n*n0->V;
+		v += nv;
+		b += nv*(n0->X - p0->X).transpose();
+		p0->StressSmooth += n*n0->Stress;
+	}
+	p0->Af = b*Dinv.asDiagonal();
+	p0->L = p0->Af.transpose();
+	if (!p0->FixV)	p0->V = v;
+	else 			p0->V = p0->Vf;
+	p0->X += p0->V*Dt;
+}
+
+// Nodes are written without atomics: colours are transferred one after another and blocks of a colour in parallel.
+// Every node sums its contributions in a fixed order (colour, block, particle ID), so the result does not depend on Nproc.
 void MPM::ParticleToNode()
 {
+	if (APIC && Dinv.norm()==0.)
+	{
+		cout << "\033[1;31mError: APIC transfer needs quadratic or cubic B-spline shape functions.\033[0m\n";
+		exit(0);
+	}
 	// reset mass internal force velocity for nodes
 	#pragma omp parallel for schedule(static) num_threads(Nproc)
 	for (size_t n=0; n<LAn.size(); ++n)
@@ -231,52 +641,28 @@ void MPM::ParticleToNode()
 		Ln[id]->Reset();
     }
     LAn.resize(0);
+    ActivateTiles();
+    if (SortInterval>0 && ++Nunsorted==SortInterval)
+    {
+    	SortParticles();
+    	Nunsorted = 0;
+    }
     // Update shape function and grad
     #pragma omp parallel for schedule(static) num_threads(Nproc)
     for (size_t p=0; p<Lp.size(); ++p)
     {
     	CalNGN(Lp[p]);
-    	Matrix3d vsp = -Lp[p]->Vol*Lp[p]->Stress;
-		Vector3d fex = Lp[p]->M*Lp[p]->B + Lp[p]->Fh + Lp[p]->Fc;
-
-		for (size_t l=0; l<Lp[p]->Lni.size(); ++l)
-		{
-			// Grid id
-			size_t id = Lp[p]->Lni[l];
-			// weight
-			double 		n 	= Lp[p]->LnN[l];
-			Vector3d 	gn 	= Lp[p]->LnGN[l];
-			Vector3d 	df 	= n*fex + vsp*gn;
-			// weigthed mass contribution
-			double nm = n*Lp[p]->M;
-			// if (nm<0.)
-			// {
-			// 	cout << "mass problem" << endl;
-			// 	cout << "nm= " << nm << endl;
-			// 	cout << "p= " << p << endl;
-			// 	cout << "id= " << id << endl;
-			// 	cout << "Lp[p]->X= " << Lp[p]->X.transpose() << endl;
-			// 	cout << "Ln[id]->X= " << Ln[id]->X.transpose() << endl;
-			// 	abort();
-			// }
-			#pragma omp atomic
-			Ln[id]->M += nm;
-			for (size_t d=0; d<D; ++d)
-			{
-				#pragma omp atomic
-				Ln[id]->Mv(d) += nm*Lp[p]->V(d);
-				#pragma omp atomic
-				Ln[id]->F(d) += df(d);
-				#pragma omp atomic
-				Ln[id]->Mv(d) += df(d)*Dt;
-				// smooth stress on node
-				for (size_t c=0; c<D; ++c)
-				{
-					#pragma omp atomic
-					Ln[id]->Stress(d,c) += nm*Lp[p]->Stress(d,c);
-				}
-			}
-		}
+    }
+    BinParticles();
+    size_t nb = Nb[0]*Nb[1]*Nb[2];
+    for (size_t c=0; c<((size_t) 1<<D); ++c)
+    {
+	    #pragma omp parallel for schedule(dynamic) num_threads(Nproc)
+	    for (size_t b=c*nb; b<(c+1)*nb; ++b)
+	    {
+	    	if (APIC)	for (size_t l=Bstart[b]; l<Bstart[b+1]; ++l)	ScatterParticleAPIC(Lp[Lpb[l]]);
+	    	else 		for (size_t l=Bstart[b]; l<Bstart[b+1]; ++l)	ScatterParticle(Lp[Lpb[l]]);
+	    }
     }
     UpdateLAn();
 }
@@ -284,10 +670,8 @@ void MPM::ParticleToNode()
 void MPM::CalNGN_MLS(MPM_PARTICLE* p0)
 {
 	// Reset shape function (N) and gradient of shape function (GN)
-	p0->Lni.resize(0);
+	p0->Nn = 0;
 	p0->Lgi.resize(0);
-	p0->LnN.resize(0);
-	p0->LnGN.resize(0);
 	// Find min position of nodes which is infuenced by this particle
 	// for nodes
 	Vector3i minn 	= Vector3i::Zero();
@@ -295,15 +679,18 @@ void MPM::CalNGN_MLS(MPM_PARTICLE* p0)
 	// for gauss points
 	Vector3i ming 	= Vector3i::Zero();
 	Vector3i maxg 	= Vector3i::Zero();
+	int nmax[3] = {(int) Nx, (int) Ny, (int) Nz};
 	for (size_t d=0; d<D; ++d)
 	{
 		// minn(d) = ceil(p0->X(d) -1.);
 		// maxn(d) = trunc(p0->X(d) +1.);
-		minn(d) = ceil(p0->X(d) -1.5);
-		maxn(d) = trunc(p0->X(d) +1.5);
+		// nodes out of the grid are skipped
+		minn(d) = max((int) ceil(p0->X(d) -1.5), 0);
+		maxn(d) = min((int) trunc(p0->X(d) +1.5), nmax[d]);
 		ming(d) = ceil(p0->X(d)-2.);
 		maxg(d) = trunc(p0->X(d)+1.);
 	}
+	if (p0->Lni.size()<Ns)	p0->SetStencilSize(Ns);
 
 	// Find nodes within the influence range
 	for (int i=minn(0); i<=maxn(0); ++i)
@@ -326,15 +713,10 @@ void MPM::CalNGN_MLS(MPM_PARTICLE* p0)
 		NGN(p0->X, Ln[id]->X, Dx, p0->PSize, n, gn);
 		if (n>0.)
 		{
-			p0->Lni.push_back(id);
-			p0->LnN.push_back(n);
-			p0->LnGN.push_back(gn);
-			Ln[id]->Actived = true;
-		}
-		// store particle ID for MLS
-		#pragma omp critical
-		{
-			Ln[id]->MPs.push_back(p0->ID);
+			p0->Lni[p0->Nn] = id;
+			p0->LnN[p0->Nn] = n;
+			p0->LnGN[p0->Nn] = gn;
+			p0->Nn++;
 		}
 	}
 	// Find nodes within the influence range
@@ -367,122 +749,131 @@ void MPM::CalNGN_MLS(MPM_PARTICLE* p0)
 	// }
 }
 
+// Particles are registered on every node within 1.5 cells for the MLS fit.
+// Called by colour and block as ScatterParticle, so nodes are written without atomics or critical sections.
+void MPM::ScatterParticleMLS(MPM_PARTICLE* p0)
+{
+	Matrix3d vsp = -p0->Vol*p0->Stress;
+	Vector3d fex = p0->M*p0->B + p0->Fh;
+
+	for (size_t l=0; l<p0->Nn; ++l)
+	{
+		size_t id = p0->Lni[l];
+		double n = p0->LnN[l];
+		Vector3d df = n*fex + vsp*p0->LnGN[l];
+		MPM_NODE* n0 = Ln[id];
+		n0->Actived = true;
+		n0->M += n*p0->M;
+		n0->F += df;
+	}
+	int nmax[3] = {(int) Nx, (int) Ny, (int) Nz};
+	int minn[3] = {0, 0, 0};
+	int maxn[3] = {0, 0, 0};
+	for (size_t d=0; d<D; ++d)
+	{
+		minn[d] = max((int) ceil(p0->X(d) -1.5), 0);
+		maxn[d] = min((int) trunc(p0->X(d) +1.5), nmax[d]);
+	}
+	for (int k=minn[2]; k<=maxn[2]; ++k)
+	for (int j=minn[1]; j<=maxn[1]; ++j)
+	for (int i=minn[0]; i<=maxn[0]; ++i)
+	{
+		Ln[i+j*Ncy+k*Ncz]->MPs.push_back(p0->ID);
+	}
+}
+
+// Velocity of a node from the MLS fit of the velocities of the particles around it
+template<int DIM>
+Vector3d MPM::FitMLS(MPM_NODE* n0)
+{
+	MLS_FIT<DIM> fit (n0->X, 0, 1.0e-2);
+	for (size_t i=0; i<n0->MPs.size(); ++i)
+	{
+		MPM_PARTICLE* p0 = Lp[n0->MPs[i]];
+		fit.Add(p0->X, p0->V);
+	}
+	return fit.Solve();
+}
+
 void MPM::ParticleToNodeMLS()
 {
-	// reset mass internal force velocity for nodes
-	// #pragma omp parallel for schedule(static) num_threads(1)
-	// for (size_t n=0; n<LAn.size(); ++n)
-	// {
-	// 	size_t id = LAn[n];
-	// 	Ln[id]->Reset();
- //    }
-    for (size_t n=0; n<Ln.size(); ++n)
+	if (D==1)
+	{
+		cout << "\033[1;31mError: MLS velocity is only implemented for 2D and 3D.\033[0m\n";
+		exit(0);
+	}
+    // MPs are stored on every node in range of a particle, not only on active nodes, so whole touched tiles are reset
+    #pragma omp parallel for schedule(static) num_threads(Nproc)
+    for (size_t l=0; l<LAt.size(); ++l)
     {
-    	Ln[n]->Reset();
+    	size_t t = LAt[l];
+    	if (!Lt[t].Touched)	continue;
+		size_t i0 = (t%Nt[0])*Ts;
+		size_t j0 = ((t/Nt[0])%Nt[1])*Ts;
+		size_t k0 = (t/(Nt[0]*Nt[1]))*Ts;
+		for (size_t k=k0; k<min(k0+Ts, Nz+1); ++k)
+		for (size_t j=j0; j<min(j0+Ts, Ny+1); ++j)
+		for (size_t i=i0; i<min(i0+Ts, Nx+1); ++i)
+		{
+			Ln[i+j*Ncy+k*Ncz]->Reset();
+		}
     }
     LAn.resize(0);
-
+    ActivateTiles();
     // Update shape function and grad
-    // #pragma omp parallel for schedule(static) num_threads(1)
+    #pragma omp parallel for schedule(static) num_threads(Nproc)
     for (size_t p=0; p<Lp.size(); ++p)
     {
-    	// UpdateLn(Lp[p]);
     	CalNGN_MLS(Lp[p]);
-
-    	Matrix3d vsp = -Lp[p]->Vol*Lp[p]->Stress;
-		Vector3d fex = Lp[p]->M*Lp[p]->B + Lp[p]->Fh;
-
-		for (size_t l=0; l<Lp[p]->Lni.size(); ++l)
-		{
-			// Grid id
-			size_t id = Lp[p]->Lni[l];
-			// weight
-			double 		n 	= Lp[p]->LnN[l];
-			Vector3d 	gn 	= Lp[p]->LnGN[l];
-			Vector3d 	df 	= n*fex + vsp*gn;
-			// weigthed mass contribution
-			double nm = n*Lp[p]->M;
-
-			if (nm<0.)
-			{
-				cout << "mass problem" << endl;
-				cout << "nm= " << nm << endl;
-				cout << "p= " << p << endl;
-				cout << "id= " << id << endl;
-				cout << "Lp[p]->X= " << Lp[p]->X.transpose() << endl;
-				cout << "Ln[id]->X= " << Ln[id]->X.transpose() << endl;
-				abort();
-			}
-			#pragma omp atomic
-			Ln[id]->M += nm;
-			#pragma omp atomic
-			Ln[id]->F(0) += df(0);
-			#pragma omp atomic
-			Ln[id]->F(1) += df(1);
-			#pragma omp atomic
-			Ln[id]->F(2) += df(2);
-		}
+    }
+    BinParticles();
+    size_t nb = Nb[0]*Nb[1]*Nb[2];
+    for (size_t c=0; c<((size_t) 1<<D); ++c)
+    {
+	    #pragma omp parallel for schedule(dynamic) num_threads(Nproc)
+	    for (size_t b=c*nb; b<(c+1)*nb; ++b)
+	    {
+	    	for (size_t l=Bstart[b]; l<Bstart[b+1]; ++l)	ScatterParticleMLS(Lp[Lpb[l]]);
+	    }
     }
     UpdateLAn();
-    // cout << "start mls" << endl;
-	// #pragma omp parallel for schedule(static) num_threads(1)
+	#pragma omp parallel for schedule(dynamic, 64) num_threads(Nproc)
 	for (size_t n=0; n<LAn.size(); ++n)
 	{
-		size_t id = LAn[n];
-		size_t nmp = Ln[id]->MPs.size();
-		bool wrong = false;
-		if (nmp>800)
-		{
-			cout << "nmp: " << nmp << endl;
-			wrong = true;
-		}
-		// position of MPs
-		vector<Vector3d> Xp;
-		// velocity of MPs
-		MatrixXd Vp(nmp,3);
-		for (size_t i=0; i<nmp; ++i)
-		{
-			// ID of MP
-			size_t p = Ln[id]->MPs[i];
-			Xp.push_back(Lp[p]->X);
-			Vp.row(i) = Lp[p]->V.transpose();
-			if (wrong)
-			{
-				cout << p << endl;
-			}
-		}
-		// shape functions
-		// VectorXd phi = MLS(Xp, Ln[id]->X, 1);
-		VectorXd phi = MLS(Xp, Ln[id]->X, 0);
-		// // node velocity
-		Ln[id]->V = phi.transpose()*Vp;
-		Ln[id]->Mv = Ln[id]->M*Ln[id]->V+Ln[id]->F;
+		MPM_NODE* n0 = Ln[LAn[n]];
+		if (D==3)	n0->V = FitMLS<3>(n0);
+		else 		n0->V = FitMLS<2>(n0);
+		n0->Mv = n0->M*n0->V+n0->F;
 	}
-	// cout << "end mls" << endl;
 }
 
+// Active nodes are collected from the tiles touched in this step instead of from the stencils of all particles
 void MPM::UpdateLAn()
 {
 	vector<vector <size_t>> lan;
 	lan.resize(Nproc);
 	#pragma omp parallel for schedule(static) num_threads(Nproc)
-	for (size_t p=0; p<Lp.size(); ++p)
+	for (size_t l=0; l<LAt.size(); ++l)
 	{
+		size_t t = LAt[l];
+		if (!Lt[t].Touched)	continue;
 		auto id = omp_get_thread_num();
-		lan[id].insert( lan[id].end(), Lp[p]->Lni.begin(), Lp[p]->Lni.end() );
-	}
-	#pragma omp parallel for schedule(static) num_threads(Nproc)
-	for (size_t n=0; n<Nproc; ++n)
-	{
-		sort( lan[n].begin(), lan[n].end() );
-		lan[n].erase(unique(lan[n].begin(), lan[n].end()), lan[n].end());
+		size_t i0 = (t%Nt[0])*Ts;
+		size_t j0 = ((t/Nt[0])%Nt[1])*Ts;
+		size_t k0 = (t/(Nt[0]*Nt[1]))*Ts;
+		for (size_t k=k0; k<min(k0+Ts, Nz+1); ++k)
+		for (size_t j=j0; j<min(j0+Ts, Ny+1); ++j)
+		for (size_t i=i0; i<min(i0+Ts, Nx+1); ++i)
+		{
+			size_t n = i+j*Ncy+k*Ncz;
+			if (Ln[n]->Actived)	lan[id].push_back(n);
+		}
 	}
+	LAn.resize(0);
 	for (size_t n=0; n<Nproc; ++n)
 	{
 		LAn.insert( LAn.end(), lan[n].begin(), lan[n].end() );
 	}
-	sort( LAn.begin(), LAn.end() );
-	LAn.erase(unique(LAn.begin(), LAn.end()), LAn.end());
 }
 
 void MPM::CalVOnNode()
@@ -514,16 +905,17 @@ void MPM::CalVOnNode()
 }
 void MPM::SetNonSlippingBC(size_t n)
 {
-	Ln[n]->BCTypes.push_back(1);
+	KeepNode(n)->BCTypes.push_back(1);
 }
 void MPM::SetNonSlippingBC(size_t i, size_t j, size_t k)
 {
 	int n = i+j*Ncy+k*Ncz;
-	Ln[n]->BCTypes.push_back(1);
+	KeepNode(n)->BCTypes.push_back(1);
 }
 
 void MPM::SetSlippingBC(size_t n, Vector3d& norm)
 {
+	KeepNode(n);
 	Ln[n]->BCTypes.push_back(2);
 	Ln[n]->Norms.push_back(norm);
 }
@@ -532,6 +924,7 @@ void MPM::SetSlippingBC(size_t i, size_t j, size_t k, Vector3d& norm)
 	int n = i+j*Ncy+k*Ncz;
 	// cout << "n= " << n << endl;
 	// cout << "Nnode= " << Nnode << endl;
+	KeepNode(n);
 	Ln[n]->BCTypes.push_back(2);
 	// cout << "push_back 1 " << endl;
 	Ln[n]->Norms.push_back(norm);
@@ -540,6 +933,7 @@ void MPM::SetSlippingBC(size_t i, size_t j, size_t k, Vector3d& norm)
 
 void MPM::SetFrictionBC(size_t n, double mu, Vector3d& norm)
 {
+	KeepNode(n);
 	Ln[n]->BCTypes.push_back(3);
 	Ln[n]->Norms.push_back(norm);
 	Ln[n]->Mu = mu;
@@ -548,6 +942,7 @@ void MPM::SetFrictionBC(size_t n, double mu, Vector3d& norm)
 void MPM::SetFrictionBC(size_t i, size_t j, size_t k, double mu, Vector3d& norm)
 {
 	int n = i+j*Ncy+k*Ncz;
+	KeepNode(n);
 	Ln[n]->BCTypes.push_back(3);
 	Ln[n]->Norms.push_back(norm);
 	Ln[n]->Mu = mu;
@@ -555,15 +950,17 @@ void MPM::SetFrictionBC(size_t i, size_t j, size_t k, double mu, Vector3d& norm)
 
 void MPM::NodeToParticle()
 {
+	ResetGroups();
 	#pragma omp parallel for schedule(static) num_threads(Nproc)
 	for (size_t p=0; p<Lp.size(); ++p)
 	{
 		// Reset position increasement of this particle
 		Lp[p]->DeltaX 	= Vector3d::Zero();
 		Lp[p]->StressSmooth.setZero();
- 		if (!Lp[p]->FixV)
+		if (APIC)	GatherParticleAPIC(Lp[p]);
+ 		else if (!Lp[p]->FixV)
 		{
-			for (size_t l=0; l<Lp[p]->Lni.size(); ++l)
+			for (size_t l=0; l<Lp[p]->Nn; ++l)
 			{
 				size_t 	id = Lp[p]->Lni[l];
 				double 	n  = Lp[p]->LnN[l];
@@ -581,7 +978,7 @@ void MPM::NodeToParticle()
 			Lp[p]->X += Lp[p]->V*Dt;
 		}
 		// Velocity gradient tensor
-		CalVGradLocal(p);
+		if (!APIC)	CalVGradLocal(p);
 		// Update deformation tensor
 		Lp[p]->F = (Matrix3d::Identity() + Lp[p]->L*Dt)*Lp[p]->F;
 		// Update particle length
@@ -589,29 +986,15 @@ void MPM::NodeToParticle()
 		// CalPSizeCP(p);
 		// Update volume of particles
 		Lp[p]->Vol 	= Lp[p]->F.determinant()*Lp[p]->Vol0;
-		// Update strain
-		Matrix3d de = 0.5*Dt*(Lp[p]->L + Lp[p]->L.transpose());
-		// Update stress
+		// Rotate stress, the constitutive update is done by UpdateStress
 		Matrix3d w = 0.5*Dt*((Lp[p]->L - Lp[p]->L.transpose()));
 		Lp[p]->Stress += w*Lp[p]->Stress-Lp[p]->Stress*w.transpose();
-		if (Lp[p]->Type==0)			Lp[p]->Elastic(de);
-		else if (Lp[p]->Type==1)
-		{
-			Lp[p]->EOSMonaghan(Cs);
-			Lp[p]->Newtonian(de);
-		}
-		else if (Lp[p]->Type==2)	Lp[p]->MohrCoulomb(de);
-		else if (Lp[p]->Type==3)	Lp[p]->DruckerPrager(de);
-		else if (Lp[p]->Type==5)
-		{
-			// Lp[p]->EOSMonaghan(Cs);
-			Lp[p]->EOSMorris(Cs);
-			Lp[p]->Granular(de);
-		}
+		GroupParticle(p);
 		// Reset hydro force and contact force
 		Lp[p]->Fh.setZero();
 		Lp[p]->Fc.setZero();
 	}
+	UpdateStress();
 	// int npf = 0;
 	// for (size_t p=0; p<Lp.size(); ++p)
 	// {
@@ -627,6 +1010,62 @@ void MPM::NodeToParticle()
 	// }
 }
 
+template<void (*K)(MPM_PARTICLE*, Matrix3d&, double)>
+void MPM::RegisterModel(int type)
+{
+	if (type<0)
+	{
+		cout << "\033[1;31mError: Material models can only be registered for Type>=0.\033[0m\n";
+		exit(0);
+	}
+	if (Models.size()<=(size_t) type)	Models.resize(type+1, NULL);
+	Models[type] = &MPM::UpdateStressGroup<K>;
+}
+
+template<void (*K)(MPM_PARTICLE*, Matrix3d&, double)>
+void MPM::UpdateStressGroup(vector<size_t>& lg)
+{
+	#pragma omp parallel for schedule(static) num_threads(Nproc)
+	for (size_t l=0; l<lg.size(); ++l)
+	{
+		MPM_PARTICLE* p0 = Lp[lg[l]];
+		Matrix3d de = 0.5*Dt*(p0->L + p0->L.transpose());
+		K(p0, de, Cs);
+	}
+}
+
+void MPM::ResetGroups()
+{
+	Lgp.resize(Nproc);
+	for (size_t i=0; i<Nproc; ++i)
+	{
+		Lgp[i].resize(Models.size());
+		for (size_t m=0; m<Models.size(); ++m)	Lgp[i][m].resize(0);
+	}
+}
+
+void MPM::GroupParticle(size_t p)
+{
+	int t = Lp[p]->Type;
+	if (t<0 || (size_t) t>=Models.size() || Models[t]==NULL)	return;
+	Lgp[omp_get_thread_num()][t].push_back(p);
+}
+
+void MPM::UpdateStress()
+{
+	Lg.resize(Models.size());
+	for (size_t m=0; m<Models.size(); ++m)
+	{
+		Lg[m].resize(0);
+		if (Models[m]==NULL)	continue;
+		for (size_t i=0; i<Lgp.size(); ++i)
+		{
+			if (m<Lgp[i].size())	Lg[m].insert(Lg[m].end(), Lgp[i][m].begin(), Lgp[i][m].end());
+		}
+		if (Lg[m].size()>0)	(this->*Models[m])(Lg[m]);
+	}
+}
+
 // void MPM::SmoothStress()
 // {}
 
@@ -660,7 +1099,7 @@ void MPM::NodeToParticle()
 void MPM::CalVGradLocal(int p)
 {
 	Lp[p]->L = Matrix3d::Zero();
-	for (size_t l=0; l<Lp[p]->Lni.size(); ++l)
+	for (size_t l=0; l<Lp[p]->Nn; ++l)
 	{
 		size_t	 	id = Lp[p]->Lni[l];
 		Vector3d 	gn 	= Lp[p]->LnGN[l];
@@ -170,4 +170,25 @@ inline void MPM_NODE::FrictionBC(double dt, Vector3d& n)
 			Mv.setZero();
 		}
 	}
-}
\ No newline at end of file
+}
+// Tile of Ts^D nodes, the background grid is allocated tile by tile when particles come close
+class MPM_TILE
+{
+public:
+	MPM_TILE();
+
+	bool 							Allocated;					// Nodes of the tile exist
+	bool 							Keep;						// Never recycled (nodes with boundary conditions)
+	unsigned char 					Touched;					// Covered by particles in this step
+	size_t 							Idle;						// Steps since the tile was last touched
+	MPM_NODE*						Nodes;						// Nodes owned by the tile, NULL if they are owned by a coupled domain
+};
+
+inline MPM_TILE::MPM_TILE()
+{
+	Allocated 	= false;
+	Keep 		= false;
+	Touched 	= 0;
+	Idle 		= 0;
+	Nodes 		= NULL;
+}
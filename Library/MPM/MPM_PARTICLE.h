@@ -30,6 +30,7 @@ public:
 	void SetMohrCoulomb(double young, double poisson, double phi, double psi, double c);
 	void SetDruckerPrager(int dptype, double young, double poisson, double phi, double psi, double c);
 	void SetTensionCutoff(double pmax);
+	void SetStencilSize(size_t ns);								// Room for ns nodes in Lni, LnN and LnGN
 	void Newtonian(Matrix3d& de);
 	void Granular(Matrix3d& de);
 	void MohrCoulomb(Matrix3d& de);
@@ -38,7 +39,7 @@ public:
 	void EOSMonaghan(double C);
 	// void DruckerPrager(Matrix3d de);
 
-    int 						Type;                       // Type of particle, 0 for elastic 1 for fluid 2 for soil.
+    int 						Type;                       // Type of particle (material model), 0 elastic, 1 Newtonian, 2 Mohr-Coulomb, 3 Drucker-Prager, 5 granular
 	int 						ID; 				    	// Index of particle in the list 
 	int 						Tag;				    	// Tag of particle
 
@@ -90,6 +91,7 @@ public:
 	Matrix3d					Stress;						// Stress
 	Matrix3d					StressSmooth;				// Smoothed Stress for visualization
 	Matrix3d					L;							// Velocity gradient tensor
+	Matrix3d					Af;							// Affine velocity matrix (APIC transfer)
 	Matrix3d					F;							// Derformation gradient tensor
 	Matrix3d					Dp;							// Elastic tensor in principal stress space
 	Matrix3d					Dpi;						// Inverse of Dp
@@ -98,8 +100,9 @@ public:
 	bool						Removed;					// whether this particle is removed
 
 	vector<int>					Lnei;						// List of neighor nodes indexs, used to calculate arc lengh for FSI problems
-	vector<size_t>				Lni;						// List of node indexs
 	vector<size_t>				Lgi;						// List of gauss point indexs
+	size_t 						Nn;							// Number of nodes in the stencil
+	vector<size_t>				Lni;						// List of node indexs, sized once for the stencil of the shape function
 	vector<double>				LnN;						// List of shape functions
 	vector<Vector3d>			LnGN;						// List of gradient of shape functions
 };
@@ -125,10 +128,9 @@ inline MPM_PARTICLE::MPM_PARTICLE()
 	Stress 	= Matrix3d::Zero();
 	StressSmooth = Matrix3d::Zero();
 	F 		= Matrix3d::Identity();
+	Af 		= Matrix3d::Zero();
 
-	Lni.resize(0);
-	LnN.resize(0);
-	LnGN.resize(0);
+	Nn 		= 0;
 
 	FixV	= false;
 	Removed	= false;
@@ -202,10 +204,9 @@ inline MPM_PARTICLE::MPM_PARTICLE(int tag, const Vector3d& x, double m)
 	Stress 	= Matrix3d::Zero();
 	StressSmooth = Matrix3d::Zero();
 	F 		= Matrix3d::Identity();
+	Af 		= Matrix3d::Zero();
 
-	Lni.resize(0);
-	LnN.resize(0);
-	LnGN.resize(0);
+	Nn 		= 0;
 
 	FixV	= false;
 	Removed	= false;
@@ -306,6 +307,13 @@ inline void MPM_PARTICLE::SetTensionCutoff(double pmax)
 	Pmax 		= pmax;
 }
 
+inline void MPM_PARTICLE::SetStencilSize(size_t ns)
+{
+	Lni.resize(ns);
+	LnN.resize(ns);
+	LnGN.resize(ns);
+}
+
 // Elastic model
 inline void MPM_PARTICLE::Elastic(Matrix3d& de)
 {
@@ -359,123 +367,33 @@ inline void MPM_PARTICLE::MohrCoulomb(Matrix3d& de)
 {
 	// Apply elastic model first
 	Elastic(de);
-	SelfAdjointEigenSolver<Matrix3d> eigensolver(Stress);
-
-	double s1 = eigensolver.eigenvalues()(2);
-	double s2 = eigensolver.eigenvalues()(1);
-	double s3 = eigensolver.eigenvalues()(0);
-
-	Vector3d sb (s1, s2, s3);
+	// Screen with the closed form principal stresses, which may be off by ~1e-8 of the deviator near repeated roots
+	Vector3d sb = EigenValuesSym3(Stress);
 
 	double sin0 = sin(Phi);
 	double cos0 = cos(Phi);
 	double sin1 = sin(Psi);
-	// double cos1 = cos(Psi);
 
-	double f = (s1-s3) +(s1+s3)*sin0 -2.*C*cos0;	
+	double f = (sb(0)-sb(2)) +(sb(0)+sb(2))*sin0 -2.*C*cos0;
+	if (f<=1.e-18-1.e-7*(sb(0)-sb(2)))	return;
+
+	// Principal axes are only needed for the return mapping
+	Matrix3d v0;
+	EigenSym3(Stress, sb, v0);
+	f = (sb(0)-sb(2)) +(sb(0)+sb(2))*sin0 -2.*C*cos0;
 
 	if (f>1.e-18)
 	{
-		Matrix3d v0;
-		v0.col(0) = eigensolver.eigenvectors().col(2);
-		v0.col(1) = eigensolver.eigenvectors().col(1);
-		v0.col(2) = eigensolver.eigenvectors().col(0);
-
-		Vector3d sc;
-
-		double sin01 = sin0*sin1;
-		double qA0 = (8.*Mu/3.-4.*K)*sin01;
-		double qA1 = Mu*(1.+sin0)*(1.+sin1);
-		double qA2 = Mu*(1.-sin0)*(1.-sin1);
-		double qB0 = 2.*C*cos0;
-
-		double gsl = 0.5*(s1-s2)/(Mu*(1.+sin1));
-		double gsr = 0.5*(s2-s3)/(Mu*(1.-sin1));
-		double gla = 0.5*(s1+s2-2.*s3)/(Mu*(3.-sin1));
-		double gra = 0.5*(2.*s1-s2-s3)/(Mu*(3.+sin1));
-
-		double qsA = qA0-4.*Mu*(1.+sin01);
-		double qsB = f;
-		
-		double qlA = qA0-qA1-2.*qA2;
-		double qlB = 0.5*(1.+sin0)*(s1+s2)-(1.-sin0)*s3-qB0;
-
-		double qrA = qA0-2.*qA1-qA2;
-		double qrB = (1.+sin0)*s1 - 0.5*(1.-sin0)*(s2+s3) - qB0;
-
-		double qaA = -4.*K*sin01;
-		double qaB = 2.*(s1+s2+s3)/3.*sin0 - qB0;
+		Vector3d sc = ReturnMohrCoulomb(sb, f, sin0, cos0, sin1, C, K, Mu);
 
-		double minslsr = min(gsl,gsr);
-		double maxlara = max(gla,gra);
-
-		if (minslsr>0. && qsA*minslsr+qsB<0.)
-		{
-			double dl = -qsB/qsA;
-			double ds0 = -dl*(2.*K-4.*Mu/3.)*sin1;
-			sc(0) = s1+ds0-dl*(2.*Mu*(1.+sin1));
-			sc(1) = s2+ds0;
-			sc(2) = s3+ds0+dl*(2.*Mu*(1.-sin1));
-		}
-		else if (gsl>0. && gla>=gsl && qlA*gsl+qlB>=0. && qlA*gla+qlB<=0.)
-		{
-			// return left edge
-			double dl = -qlB/qlA;
-			double ds0 = dl*(4.*Mu/3.-2.*K)*sin1;
-			sc(0) = sc(1) = 0.5*(s1+s2)+ds0 - dl*Mu*(1.+sin1);
-			sc(2) = s3+ds0 + 2.*dl*Mu*(1.-sin1);
-			// cout << "left edge" << endl;
-			// abort();
-		}
-		else if (gsr>0. && gra>=gsr && qrA*gsr+qrB>=0. && qrA*gra+qrB<=0.)
-		{
-			double dl = -qrB/qrA;
-			double ds0 = dl*(4.*Mu/3.-2.*K)*sin1;
-			sc(0) = s1 + ds0 - 2.*dl*Mu*(1.+sin1);
-			sc(1) = sc(2) = 0.5*(s2+s3) + ds0 + dl*Mu*(1.-sin1);
-			// cout << "right edge" << endl;
-		}
-		else if (maxlara>0. && qaA*maxlara+qaB>=-1.e-24)
-		{
-			sc(0) = sc(1) = sc(2) = C/tan(Phi);
-			// cout << "apex" << endl;
-		}
-		else
-		{
-			cout << "undefined" << endl;
-			cout << s1 << " " << s2 << " " << s3 << endl;
-			cout << "minslsr:" << minslsr << endl;
-			cout << "qsA*minslsr+qsB: " << qsA*minslsr+qsB << endl;
-			cout << "===============" << endl;
-			cout << "gsl: " << gsl << endl;
-			cout << "gla: " << gla << endl;
-			cout << "qlA*gsl+qlB: " << qlA*gsl+qlB << endl;
-			cout << "qlA*gla+qlB: " << qlA*gla+qlB << endl;
-			cout << "===============" << endl;
-			cout << "gsr: " << gsr << endl;
-			cout << "gra: " << gra << endl;
-			cout << "qrA*gsr+qrB: " << qrA*gsr+qrB << endl;
-			cout << "qrA*gra+qrB: " << qrA*gra+qrB << endl;	
-			cout << "===============" << endl;		
-			cout << "maxlara " << maxlara << endl;
-			cout << "qaA*maxlara+qaB: " << qaA*maxlara+qaB << endl;
-			cout << "f: " << f << endl;
-			abort();
-		}
-
-		Matrix3d sp = Matrix3d::Zero();
-		sp(0,0) = sc(0);
-		sp(1,1) = sc(1);
-		sp(2,2) = sc(2);
-
-		Stress = v0 * sp * v0.inverse();
+		Stress = v0*sc.asDiagonal()*v0.transpose();
 		double fa = (sc(0)-sc(2)) +(sc(0)+sc(2))*sin0 -2.*C*cos0;
 		if (abs(fa)>1.0e-12)
 		{
 			cout << "f before: " << f << endl;
 			cout << "f after: " << fa << endl;
 			cout << sc.transpose() << endl;
-			abort();			
+			abort();
 		}
 	}
 }
@@ -485,26 +403,14 @@ void MPM_PARTICLE::DruckerPrager(Matrix3d& de)
 	// Apply elastic model first
 	Elastic(de);
 	double p = Stress.trace()/3.;
-	Matrix3d ss = Stress - p*Matrix3d::Identity();
-	double j2sqr = sqrt(0.5*(ss.array()*ss.array()).sum());
+	Matrix3d ss = Stress;
+	ss.diagonal().array() -= p;
+	double j2sqr = sqrt(0.5*ss.squaredNorm());
 	double f = j2sqr+A_dp*p-B_dp*C;
 	if (f>0.)
 	{
-		if (A_dp*(p-j2sqr/Mu*K*Ad_dp)-B_dp*C<0.)
-		{
-			// cout << "return cone" << endl;
-			double dl = (j2sqr+A_dp*p-B_dp*C)/(Mu+A_dp*K*Ad_dp);
-			Stress -= dl*(Mu/j2sqr*ss+K*Ad_dp*Matrix3d::Identity());
-		}
-		else
-		{
-			Stress = B_dp*C*Matrix3d::Identity();
-		}
-		p = Stress.trace()/3.;
-		ss = Stress - p*Matrix3d::Identity();
-		j2sqr = sqrt(0.5*(ss.array()*ss.array()).sum());
 		double fb = f;
-		f = j2sqr+A_dp*p-B_dp*C;
+		f = ReturnDruckerPrager(Stress, p, ss, j2sqr, f, A_dp, B_dp, Ad_dp, C, K, Mu);
 		if (f>1.0e-8)
 		{
 			cout << "f before: " << fb << endl;
@@ -512,4 +418,32 @@ void MPM_PARTICLE::DruckerPrager(Matrix3d& de)
 			abort();
 		}
 	}
-}
\ No newline at end of file
+}
+
+// Stress update kernels registered by MPM for each particle Type (see MPM::RegisterModel)
+inline void ModelElastic(MPM_PARTICLE* p0, Matrix3d& de, double cs)
+{
+	p0->Elastic(de);
+}
+
+inline void ModelNewtonian(MPM_PARTICLE* p0, Matrix3d& de, double cs)
+{
+	p0->EOSMonaghan(cs);
+	p0->Newtonian(de);
+}
+
+inline void ModelMohrCoulomb(MPM_PARTICLE* p0, Matrix3d& de, double cs)
+{
+	p0->MohrCoulomb(de);
+}
+
+inline void ModelDruckerPrager(MPM_PARTICLE* p0, Matrix3d& de, double cs)
+{
+	p0->DruckerPrager(de);
+}
+
+inline void ModelGranular(MPM_PARTICLE* p0, Matrix3d& de, double cs)
+{
+	p0->EOSMorris(cs);
+	p0->Granular(de);
+}
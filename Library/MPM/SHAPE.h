@@ -398,6 +398,58 @@ void GIMP3D(Vector3d& x, Vector3d& xc, Vector3d& l, Vector3d& lp, double& n, Vec
 	gn(1) = gn1*n0*n2;
 	gn(2) = gn2*n0*n1;
 }
+// ======================================================================
+// Shape functions specialised at compile time on the type T (0 for Linear, 1 for Quadratic, 2 for Cubic and 3 for GIMP)
+// and the dimension D. The 3D functions are tensor products of the 1D factors.
+template<int T>
+inline void Shape1D(double x, double xc, double lx, double lpx, double& n, double& gn);
+
+template<>
+inline void Shape1D<0>(double x, double xc, double lx, double lpx, double& n, double& gn)
+{
+	n 	= ShapeL(x, xc, lx);
+	gn 	= DShapeL(x, xc, lx);
+}
+
+template<>
+inline void Shape1D<1>(double x, double xc, double lx, double lpx, double& n, double& gn)
+{
+	n 	= ShapeQ(x, xc, lx);
+	gn 	= DShapeQ(x, xc, lx);
+}
+
+template<>
+inline void Shape1D<2>(double x, double xc, double lx, double lpx, double& n, double& gn)
+{
+	n 	= ShapeC(x, xc, lx);
+	gn 	= DShapeC(x, xc, lx);
+}
+
+template<>
+inline void Shape1D<3>(double x, double xc, double lx, double lpx, double& n, double& gn)
+{
+	GIMP(x, xc, lx, lpx, n, gn);
+}
+
+// Influence range of the shape function, in addition to the half length of the particle for GIMP
+template<int T>
+inline double ShapeRange()
+{
+	return (T==1) ? 1.5 : (T==2) ? 2. : 1.;
+}
+
+template<int D, int T>
+void NGNT(Vector3d& x, Vector3d& xc, Vector3d& l, Vector3d& lp, double& n, Vector3d& gn)
+{
+	double n1[3] 	= {1., 1., 1.};
+	double gn1[3] 	= {0., 0., 0.};
+	for (int d=0; d<D; ++d)	Shape1D<T>(x(d), xc(d), l(d), lp(d), n1[d], gn1[d]);
+	n = n1[0]*n1[1]*n1[2];
+	gn(0) = gn1[0]*n1[1]*n1[2];
+	gn(1) = n1[0]*gn1[1]*n1[2];
+	gn(2) = n1[0]*n1[1]*gn1[2];
+}
+
 // ======================================================================
 // MLS
 // polynomials
@@ -461,47 +513,80 @@ double WeightC3D(Vector3d& x, Vector3d& xc, Vector3d& l)
 	return w;
 }
 
-VectorXd MLS(vector<Vector3d>& Xp, Vector3d& xc, size_t wtype)
+// Moving least squares fit at xc with the quadratic basis
+// D=2: 1, x, y, x^2, xy, y^2
+// D=3: 1, x, y, z, x^2, y^2, z^2, xy, yz, zx
+// Samples are added one by one to the fixed size moment matrix sum(w*p*p^T) (Eq. 10), so there is no limit on their number.
+// Vis regularises the quadratic terms, the fit is solved with LDLT (Eq. 11).
+template<int D>
+class MLS_FIT
 {
-	size_t n = Xp.size();
+public:
+	static const int 				Nb = (D==3) ? 10 : 6;								// Number of basis functions
+	MLS_FIT(const Vector3d& xc, size_t wtype, double vis);
+	void Basis(const Vector3d& x, Matrix<double, Nb, 1>& p);
+	void Add(const Vector3d& x, const Vector3d& v);										// Add a sample with value v at x
+	Vector3d Solve();																	// Value of the fit at xc
+
+	Vector3d 						Xc;
+	size_t 							Wtype;												// 0 for quadratic and 1 for cubic spline weights
+	double 							Vis;
+	Matrix<double, Nb, Nb> 			Mm;													// Moment matrix
+	Matrix<double, Nb, 3> 			Rm;													// Weighted moments of the samples
+};
+
+template<int D>
+inline MLS_FIT<D>::MLS_FIT(const Vector3d& xc, size_t wtype, double vis)
+{
+	Xc 		= xc;
+	Wtype 	= wtype;
+	Vis 	= vis;
+	Mm.setZero();
+	Rm.setZero();
+}
 
-	if (n>800)
+template<int D>
+inline void MLS_FIT<D>::Basis(const Vector3d& x, Matrix<double, Nb, 1>& p)
+{
+	Vector3d r = x-Xc;
+	p(0) = 1.;
+	for (int d=0; d<D; ++d)
+	{
+		p(1+d) 		= r(d);
+		p(1+D+d) 	= r(d)*r(d);
+	}
+	if (D==2)	p(5) = r(0)*r(1);
+	else
 	{
-		cout << "n= " << n << endl;
-		abort();
+		p(7) = r(0)*r(1);
+		p(8) = r(1)*r(2);
+		p(9) = r(2)*r(0);
 	}
+}
 
-	MatrixXd Pm(n,6);
-	MatrixXd Wm(n,n);
-	Wm.setZero();
-	for (size_t i=0; i<n; ++i)
+template<int D>
+inline void MLS_FIT<D>::Add(const Vector3d& x, const Vector3d& v)
+{
+	double w = 1.;
+	for (int d=0; d<D; ++d)
 	{
-		VectorXd pi = PQ2D(Xp[i], xc);
-		Pm.row(i) = pi.transpose();
-		// cout << pi.transpose() << endl;
-		// Wm(i,i) = WeightC(abs(Xp[i](0)-xc(0)), 1.)*WeightC(abs(Xp[i](1)-xc(1)), 1.);
-		if (wtype==0) Wm(i,i) = WeightQ(abs(Xp[i](0)-xc(0)), 1.)*WeightQ(abs(Xp[i](1)-xc(1)), 1.);
-		else if (wtype==1) Wm(i,i) = WeightC(abs(Xp[i](0)-xc(0)), 1.)*WeightC(abs(Xp[i](1)-xc(1)), 1.);
-		// if (wtype==0) Wm(i,i) = WeightQ((Xp[i]-xc).norm(), 1.);
-		// else if (wtype==1) Wm(i,i) = WeightC((Xp[i]-xc).norm(), 1.);
+		if (Wtype==0)	w *= WeightQ(abs(x(d)-Xc(d)), 1.);
+		else 			w *= WeightC(abs(x(d)-Xc(d)), 1.);
 	}
-	// cout << "n= " << n << endl;
-	// Eq. 10
-	MatrixXd Mm = Pm.transpose()*(Wm*Pm);
-	// additional constraints
-	// if (n>2)
-	// {
-		Mm(5,5) += 1.0e-2;
-		Mm(4,4) += 1.0e-2;
-		Mm(3,3) += 1.0e-2;
-	// }
-	// Eq. 11
-	VectorXd Pc = PQ2D(xc,xc);
-	// cout << "start phi" << endl;
-	VectorXd phi = Pc.transpose()*Mm.inverse()*Pm.transpose()*Wm;
-	// cout << "finish phi" << endl;
-	// VectorXd phi;
-	return phi;
+	if (w==0.)	return;
+	Matrix<double, Nb, 1> p;
+	Basis(x, p);
+	Mm.template selfadjointView<Lower>().rankUpdate(p, w);
+	Rm.noalias() += w*p*v.transpose();
+}
+
+template<int D>
+inline Vector3d MLS_FIT<D>::Solve()
+{
+	for (int i=1+D; i<Nb; ++i)	Mm(i,i) += Vis;
+	Matrix<double, Nb, 3> a = Mm.template selfadjointView<Lower>().ldlt().solve(Rm);
+	// The basis is centred at xc, so only the constant term is left
+	return a.row(0).transpose();
 }
 
 VectorXd MLS1(vector<Vector3d>& Xp, Vector3d& xc, double vis, size_t wtype)
@@ -0,0 +1,173 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Scoped wall clock profiler, enabled by compiling with -DCFSM_PROFILE.
+// PROFILE_SCOPE("name") times the enclosing scope with a monotonic clock, each thread keeps its own statistics.
+// Samples are not stored, every phase keeps count, total, max and a log histogram (1e-6 ms to 1e5 ms, 20 bins per decade),
+// so memory does not grow with the number of steps and p50/p99 are accurate to about 6%.
+// PROFILE_WRITE("prefix") prints mean/p50/p99 of every phase and writes prefix.csv and prefix.json.
+// Without CFSM_PROFILE both macros expand to nothing.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifdef CFSM_PROFILE
+
+struct PROFILE_STAT
+{
+	static const size_t 			Nbin = 221;												// 11 decades, 20 bins per decade, and one bin for larger values
+	static const size_t 			Nbd = 20;												// Bins per decade
+	size_t 							Count;
+	double 							Total;													// ms
+	double 							Max;													// ms
+	size_t 							Hist[Nbin];
+
+	PROFILE_STAT()	{Reset();}
+	void Reset()	{Count = 0; Total = 0.; Max = 0.; for (size_t b=0; b<Nbin; ++b)	Hist[b] = 0;}
+	static size_t Bin(double ms)
+	{
+		if (ms<=1.0e-6)	return 0;
+		double b = Nbd*(log10(ms)+6.);
+		return (b>=Nbin-1)? Nbin-1 : (size_t) b;
+	}
+	static double Value(size_t b)	{return pow(10., (b+0.5)/Nbd-6.);}					// Geometric centre of bin b
+	void Add(double ms)
+	{
+		Count++;
+		Total += ms;
+		Max = max(Max, ms);
+		Hist[Bin(ms)]++;
+	}
+	void Merge(const PROFILE_STAT& s)
+	{
+		Count += s.Count;
+		Total += s.Total;
+		Max = max(Max, s.Max);
+		for (size_t b=0; b<Nbin; ++b)	Hist[b] += s.Hist[b];
+	}
+	double Percentile(double q) const
+	{
+		size_t k = (size_t) (q*(Count-1));
+		size_t c = 0;
+		for (size_t b=0; b<Nbin; ++b)
+		{
+			c += Hist[b];
+			if (c>k)	return min(Value(b), Max);
+		}
+		return Max;
+	}
+};
+
+class PROFILER
+{
+public:
+	static PROFILER& Get();
+	size_t Id(const char* name);															// Register a phase, called once per PROFILE_SCOPE
+	void Add(size_t id, double ms);
+	void Write(string prefix);
+	void Reset();
+
+	static const size_t 			MaxThreads = 256;
+	vector<string> 					Names;													// Name of each phase
+	vector<PROFILE_STAT> 			Stats[MaxThreads];										// Statistics of each phase, of each thread
+};
+
+inline PROFILER& PROFILER::Get()
+{
+	static PROFILER prof;
+	return prof;
+}
+
+inline size_t PROFILER::Id(const char* name)
+{
+	size_t id;
+	#pragma omp critical(PROFILER_ID)
+	{
+		id = find(Names.begin(), Names.end(), string(name))-Names.begin();
+		if (id==Names.size())	Names.push_back(name);
+	}
+	return id;
+}
+
+inline void PROFILER::Add(size_t id, double ms)
+{
+	size_t tid = omp_get_thread_num();
+	if (tid>=MaxThreads)	return;
+	vector<PROFILE_STAT>& s = Stats[tid];
+	if (s.size()<=id)	s.resize(id+1);
+	s[id].Add(ms);
+}
+
+inline void PROFILER::Reset()
+{
+	for (size_t t=0; t<MaxThreads; ++t)	Stats[t].clear();
+}
+
+inline void PROFILER::Write(string prefix)
+{
+	ofstream csv(prefix+".csv", ios_base::out);
+	ofstream json(prefix+".json", ios_base::out);
+	csv << "Phase,Count,Total_ms,Mean_ms,P50_ms,P99_ms,Max_ms\n";
+	json << "{\n";
+	cout << "========= Profile (wall time in ms) =========" << endl;
+	cout << setw(24) << left << "Phase" << right << setw(10) << "Count" << setw(14) << "Total" << setw(12) << "Mean" << setw(12) << "P50" << setw(12) << "P99" << endl;
+	bool first = true;
+	for (size_t id=0; id<Names.size(); ++id)
+	{
+		PROFILE_STAT s;
+		for (size_t t=0; t<MaxThreads; ++t)
+		{
+			if (Stats[t].size()>id)	s.Merge(Stats[t][id]);
+		}
+		if (s.Count==0)	continue;
+		double mean = s.Total/s.Count;
+		double p50 = s.Percentile(0.50);
+		double p99 = s.Percentile(0.99);
+		csv << Names[id] << "," << s.Count << "," << s.Total << "," << mean << "," << p50 << "," << p99 << "," << s.Max << "\n";
+		if (!first)	json << ",\n";
+		json << "  \"" << Names[id] << "\": {\"count\": " << s.Count << ", \"total_ms\": " << s.Total << ", \"mean_ms\": " << mean << ", \"p50_ms\": " << p50 << ", \"p99_ms\": " << p99 << ", \"max_ms\": " << s.Max << "}";
+		first = false;
+		cout << setw(24) << left << Names[id] << right << setw(10) << s.Count << setw(14) << s.Total << setw(12) << mean << setw(12) << p50 << setw(12) << p99 << endl;
+	}
+	json << "\n}\n";
+}
+
+class PROFILE_TIMER
+{
+public:
+	PROFILE_TIMER(size_t id) : Id(id), Start(std::chrono::steady_clock::now()) {}
+	~PROFILE_TIMER()	{PROFILER::Get().Add(Id, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-Start).count());}
+
+	size_t 							Id;
+	std::chrono::steady_clock::time_point Start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) static const size_t PROFILE_CONCAT(profile_id_, __LINE__) = PROFILER::Get().Id(name); PROFILE_TIMER PROFILE_CONCAT(profile_timer_, __LINE__) (PROFILE_CONCAT(profile_id_, __LINE__))
+#define PROFILE_WRITE(prefix) PROFILER::Get().Write(prefix)
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_WRITE(prefix)
+
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Checkpoint and restart: a run interrupted halfway and continued from its checkpoint
+// must give the same particles, bit by bit, as the run without interruption.
+
+#include <DEM.h>
+
+DEM* NewDomain()
+{
+	DEM* a = new DEM(20, 20, 20, "HERTZ", "DEFULT", 0.5);
+	a->Init();
+	a->Periodic[0] = false;
+	a->Periodic[1] = false;
+	a->Periodic[2] = false;
+	a->Nproc = 2;
+	return a;
+}
+
+int main(int argc, char const *argv[])
+{
+	int tt = 20000;
+	int ts = 1000;
+	double dt = 0.02;
+
+	// Initial state, saved once so that all runs start from the same random packing
+	DEM* a = NewDomain();
+	// the clump first, the packing keeps clear of existing particles
+	vector<Vector3d> xc = {Vector3d(10.,10.,16.), Vector3d(11.5,10.,16.), Vector3d(10.,11.2,16.5)};
+	vector<double> rc = {1., 0.8, 0.7};
+	a->AddClump(1, xc, rc, 1.);
+	Vector3d x0 (1., 1., 1.);
+	Vector3d x1 (19., 19., 19.);
+	a->AddNSpheres(0, 50, x0, x1, 1., 0., 1.);
+	// walls included, their Young's modulus is 0 by default
+	for (size_t p=0; p<a->Lp.size(); ++p)
+	{
+		a->Lp[p]->Young = 1.e3;
+		a->Lp[p]->Poisson = 0.3;
+	}
+	Vector3d g (0., 0., -1.e-2);
+	a->SetG(g);
+	a->Lg[0]->G = g;
+	a->SortInterval = 50;
+	a->WriteCheckpoint("DEM_Init.bin");
+
+	// Uninterrupted run
+	DEM* b = NewDomain();
+	b->ReadCheckpoint("DEM_Init.bin");
+	b->Solve(tt, ts, dt, false);
+
+	// Interrupted run, Solve writes a checkpoint before every step, the last one is of step tt/2-1
+	DEM* c = NewDomain();
+	c->ReadCheckpoint("DEM_Init.bin");
+	c->CheckpointInterval = 1.e-12;
+	c->Solve(tt/2, ts, dt, false);
+
+	DEM* d = NewDomain();
+	d->ReadCheckpoint("DEM_Checkpoint.bin");
+	d->Solve(tt, ts, dt, false);
+
+	size_t ndiff = 0;
+	for (size_t p=0; p<b->Lp.size(); ++p)
+	{
+		DEM_PARTICLE* p0 = b->Lp[p];
+		DEM_PARTICLE* p1 = d->Lp[p];
+		if (p0->X!=p1->X || p0->V!=p1->V || p0->W!=p1->W || p0->Q.coeffs()!=p1->Q.coeffs())	ndiff++;
+	}
+	cout << "Particles different after restart: " << ndiff << " of " << b->Lp.size() << endl;
+	// the packing must have settled on the bottom wall, not be in free fall
+	double vmax = 0.;
+	for (size_t p=6; p<b->Lp.size(); ++p)	vmax = max(vmax, b->Lp[p]->V.norm());
+	cout << "Max velocity: " << vmax << endl;
+	if (ndiff>0 || b->Lp.size()!=d->Lp.size() || !(vmax<0.1))
+	{
+		cout << "\033[1;31mFAILED\033[0m" << endl;
+		return 1;
+	}
+	cout << "PASSED" << endl;
+	return 0;
+}
@@ -0,0 +1,77 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// A clump of a cuboid and a sphere spinning freely (no contacts, no gravity).
+// Vertices of the cuboid must keep their place in the frame of the clump while it turns.
+
+#include <DEM.h>
+
+int main(int argc, char const *argv[])
+{
+	DEM* a = new DEM(100, 100, 100, "HERTZ", "DEFULT", 0.5);
+	a->Init();
+	a->Nproc = 1;
+	a->Dt = 0.01;
+
+	Vector3d x0 (50., 50., 50.);
+	Vector3d x1 (53., 50., 50.);
+	a->AddCuboid(1, 4., 2., 1., x0, 1.);
+	a->AddSphere(2, 1.5, x1, 1.);
+
+	// Group built by hand, SetClump is called on its first step
+	DEM_PARTICLE* g0 = new DEM_PARTICLE(0, x0, 1.);
+	g0->ID = a->Lg.size();
+	for (size_t p=6; p<a->Lp.size(); ++p)
+	{
+		a->Lp[p]->Group = a->Lg.size();
+		g0->Lp.push_back(p);
+	}
+	a->Lg.push_back(g0);
+	g0->W << 0.01, 0.02, 0.05;
+
+	a->SetClump(g0);
+	DEM_PARTICLE* c0 = a->Lp[6];
+	c0->UpdateP();
+	vector<Vector3d> pg (c0->P.size());
+	for (size_t k=0; k<c0->P.size(); ++k)	pg[k] = g0->Qfi._transformVector(c0->P[k]-g0->X);
+
+	double err = 0.;
+	double turn = 0.;
+	for (int t=0; t<5000; ++t)
+	{
+		a->Move();
+		a->ZeroForceTorque(true, true);
+		c0->UpdateP();
+		for (size_t k=0; k<c0->P.size(); ++k)
+		{
+			Vector3d xk = g0->Qfi._transformVector(c0->P[k]-g0->X);
+			err = max(err, (xk-pg[k]).norm());
+		}
+		turn = max(turn, g0->Q.vec().norm());
+	}
+	cout << "Max rotation of the clump (|Q.vec|): " << turn << endl;
+	cout << "Max drift of cuboid vertices in the clump frame: " << err << endl;
+	if (turn<0.5 || err>1.e-8)
+	{
+		cout << "\033[1;31mFAILED\033[0m" << endl;
+		return 1;
+	}
+	cout << "PASSED" << endl;
+	return 0;
+}
@@ -0,0 +1,122 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Probe output: three particles are probed while the packing is sorted along the Morton curve,
+// one of them is deleted halfway. DEM_Probe.h5 is read back and checked against the particles.
+
+#include <DEM.h>
+
+int main(int argc, char const *argv[])
+{
+	int tt = 2000;
+	double dt = 0.02;
+
+	DEM* a = new DEM(20, 20, 20, "HERTZ", "DEFULT", 0.5);
+	a->Init();
+	a->Periodic[0] = false;
+	a->Periodic[1] = false;
+	a->Periodic[2] = false;
+	a->Nproc = 2;
+
+	Vector3d x0 (1., 1., 1.);
+	Vector3d x1 (19., 19., 19.);
+	a->AddNSpheres(0, 50, x0, x1, 1., 0., 1.);
+	// walls included, their Young's modulus is 0 by default
+	for (size_t p=0; p<a->Lp.size(); ++p)
+	{
+		a->Lp[p]->Young = 1.e3;
+		a->Lp[p]->Poisson = 0.3;
+	}
+	Vector3d g (0., 0., -1.e-2);
+	a->SetG(g);
+	a->SortInterval = 50;
+
+	vector<size_t> id = {6, 7, 8};
+	for (size_t i=0; i<id.size(); ++i)	a->AddProbe(id[i]);
+	a->Probe.BufferSize = 64;
+	a->ProbeInterval = 1;
+
+	// first half, then delete the second probed particle and continue
+	a->Solve(tt/2, tt, dt, false);
+	a->Lp[a->Probe.Lp[1]]->removed = true;
+	a->DeleteParticles();
+	a->Step = tt/2;
+	a->Solve(tt, tt, dt, false);
+
+	bool passed = true;
+	if (a->Probe.Lp[1]!=DEM_PROBE::Removed)
+	{
+		cout << "Deleted particle is still probed" << endl;
+		passed = false;
+	}
+
+	H5File file(a->Probe.FileName, H5F_ACC_RDONLY);
+	DataSet label = file.openDataSet("Label");
+	vector<unsigned long> lab (id.size());
+	label.read(lab.data(), PredType::NATIVE_ULONG);
+	for (size_t i=0; i<id.size(); ++i)	if (lab[i]!=id[i])	passed = false;
+
+	DataSet time = file.openDataSet("Time");
+	hsize_t nt;
+	time.getSpace().getSimpleExtentDims(&nt);
+	vector<double> tm (nt);
+	time.read(tm.data(), PredType::NATIVE_DOUBLE);
+	cout << "Records: " << nt << endl;
+	if (nt!=(hsize_t) tt)	passed = false;
+	// record k holds the state at the end of step k
+	for (size_t k=0; k<tm.size(); ++k)	if (tm[k]!=(k+1)*dt)	passed = false;
+
+	DataSet state = file.openDataSet("State");
+	hsize_t dims[2];
+	state.getSpace().getSimpleExtentDims(dims);
+	vector<double> st (dims[0]*dims[1]);
+	state.read(st.data(), PredType::NATIVE_DOUBLE);
+	file.close();
+	if (dims[0]!=nt || dims[1]!=id.size()*DEM_PROBE::Ncol)	passed = false;
+	else
+	{
+		// the deleted particle is NaN from the deletion on, the others are never
+		for (size_t k=0; k<nt; ++k)
+		for (size_t i=0; i<id.size(); ++i)
+		{
+			bool nan = std::isnan(st[k*dims[1]+i*DEM_PROBE::Ncol]);
+			if (nan!=(i==1 && k>=(size_t) tt/2))	passed = false;
+		}
+		// the last record of the others is the final state of the particles they follow after sorting
+		for (size_t i=0; i<id.size(); ++i)
+		{
+			if (i==1)	continue;
+			DEM_PARTICLE* p0 = a->Lp[a->Probe.Lp[i]];
+			const double* s = &st[(nt-1)*dims[1]+i*DEM_PROBE::Ncol];
+			for (size_t c=0; c<3; ++c)
+			{
+				if (s[c]!=p0->X(c) || s[3+c]!=p0->V(c))	passed = false;
+			}
+			cout << "Probe " << id[i] << " now particle " << a->Probe.Lp[i] << " at " << p0->X.transpose() << endl;
+		}
+	}
+
+	if (!passed)
+	{
+		cout << "\033[1;31mFAILED\033[0m" << endl;
+		return 1;
+	}
+	cout << "PASSED" << endl;
+	return 0;
+}
@@ -0,0 +1,125 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// 2D spinning block with APIC transfer. Without stiffness only the transfers act on the block and its particles fly apart
+// on straight lines: angular momentum of the grid must be conserved, the particles must carry the same angular momentum
+// (including the affine part), kinetic energy must not be dissipated and the affine matrix must follow the velocity gradient
+// of the free flight.
+
+#include <MPM.h>
+
+int main(int argc, char const *argv[])
+{
+	Vector3d gridSize (1,1,1);
+	int nx = 40;
+	int ny = 40;
+	int nz = 0;
+	// Quadratic B-spline, APIC needs B-splines
+	MPM* a = new MPM(1, nx, ny, nz, gridSize);
+	a->Init();
+	a->Nproc = 1;
+	a->APIC = true;
+
+	Vector3d x0 (14, 14, 0);
+	Vector3d l0 (12, 12, 0);
+	a->AddBoxParticles(-1, x0, l0, 0.5, 1.);
+	// Rigid rotation around the center of the block, the affine matrix starts as its velocity gradient
+	Vector3d c (20, 20, 0);
+	double w = 2.0e-3;
+	for (size_t p=0; p<a->Lp.size(); ++p)
+	{
+		a->Lp[p]->SetElastic(0., 0.3);
+		Vector3d r = a->Lp[p]->X-c;
+		a->Lp[p]->V << -w*r(1), w*r(0), 0.;
+		a->Lp[p]->Af(0,1) = -w;
+		a->Lp[p]->Af(1,0) = w;
+	}
+	// Angular momentum around c of the grid (after ParticleToNode) and of the particles, B = Af*D
+	auto gridL = [&]()
+	{
+		double l = 0.;
+		for (size_t n=0; n<a->LAn.size(); ++n)
+		{
+			MPM_NODE* n0 = a->Ln[a->LAn[n]];
+			Vector3d r = n0->X-c;
+			l += r(0)*n0->Mv(1)-r(1)*n0->Mv(0);
+		}
+		return l;
+	};
+	auto particleL = [&]()
+	{
+		double l = 0.;
+		for (size_t p=0; p<a->Lp.size(); ++p)
+		{
+			MPM_PARTICLE* p0 = a->Lp[p];
+			Vector3d r = p0->X-c;
+			l += p0->M*(r(0)*p0->V(1)-r(1)*p0->V(0));
+			l += p0->M*(p0->Af(1,0)/a->Dinv(0)-p0->Af(0,1)/a->Dinv(1));
+		}
+		return l;
+	};
+
+	auto energy = [&]()
+	{
+		double e = 0.;
+		for (size_t p=0; p<a->Lp.size(); ++p)	e += 0.5*a->Lp[p]->M*a->Lp[p]->V.squaredNorm();
+		return e;
+	};
+
+	int tt = 400;
+	double e0 = energy();
+	double l0p = particleL();
+	a->ParticleToNode();
+	double l0g = gridL();
+	for (int t=0; t<tt; ++t)
+	{
+		if (t>0)	a->ParticleToNode();
+		a->CalVOnNode();
+		a->NodeToParticle();
+	}
+	double l1p = particleL();
+	a->ParticleToNode();
+	double l1g = gridL();
+	cout << "Angular momentum of particles: " << l0p << " -> " << l1p << endl;
+	cout << "Angular momentum of grid:      " << l0g << " -> " << l1g << endl;
+	double e1 = energy();
+	cout << "Kinetic energy of particles:   " << e0 << " -> " << e1 << endl;
+
+	// Velocity gradient of the free flight x = (I+t*C)*x0 is C*(I+t*C)^-1, the spin decreases as the block expands
+	double wt = w*tt;
+	double spin = w/(1.+wt*wt);
+	double expansion = w*wt/(1.+wt*wt);
+	double errAf = 0.;
+	for (size_t p=0; p<a->Lp.size(); ++p)
+	{
+		Matrix3d& af = a->Lp[p]->Af;
+		errAf = max(errAf, max(abs(af(0,1)+spin), abs(af(1,0)-spin)));
+		errAf = max(errAf, max(abs(af(0,0)-expansion), abs(af(1,1)-expansion)));
+	}
+	cout << "Max deviation of Af from the free flight: " << errAf/w << " w" << endl;
+
+	double tol = 1.0e-10*abs(l0g);
+	if (abs(l0g-l0p)>tol || abs(l1g-l0g)>tol || abs(l1p-l1g)>tol || abs(e1-e0)>1.0e-2*e0 || errAf>0.1*w)
+	{
+		cout << "\033[1;31mFAILED\033[0m" << endl;
+		return 1;
+	}
+	cout << "PASSED" << endl;
+	return 0;
+}
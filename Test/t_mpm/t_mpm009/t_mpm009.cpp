@@ -0,0 +1,101 @@
+/************************************************************************
+ * ComFluSoM - Simulation kit for Fluid Solid Soil Mechanics            *
+ * Copyright (C) 2019 Pei Zhang                                         *
+ * Email: peizhang.hhu@gmail.com                                        *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * any later version.                                                   *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program. If not, see <http://www.gnu.org/licenses/>  *
+ ************************************************************************/
+
+// Thread count independence: a 3D Mohr-Coulomb column collapsing on slipping walls, with particles reordered
+// along the Morton curve, must give the same particles, bit by bit, with 1 and 4 threads.
+
+#include <MPM.h>
+
+MPM* NewDomain(size_t nproc)
+{
+	Vector3d gridSize (1,1,1);
+	int nx = 30;
+	int ny = 20;
+	int nz = 20;
+	// Quadratic B-spline
+	MPM* a = new MPM(1, nx, ny, nz, gridSize);
+	a->Init();
+	a->Nproc = nproc;
+	a->SortInterval = 10;
+	a->SortMorton = true;
+
+	Vector3d x0 (5, 5, 2);
+	Vector3d l0 (8, 6, 8);
+	a->AddBoxParticles(-1, x0, l0, 0.5, 1.);
+	Vector3d g (0., 0., -1.e-4);
+	for (size_t p=0; p<a->Lp.size(); ++p)
+	{
+		a->Lp[p]->SetMohrCoulomb(1.e-1, 0.3, 30./180.*M_PI, 0., 0.);
+		a->Lp[p]->B = g;
+	}
+	// Bottom
+	Vector3d nb (0., 0., -1.);
+	for (int i=0; i<=nx; ++i)
+	for (int j=0; j<=ny; ++j)
+	for (int k=0; k<=2; ++k)
+	{
+		a->SetSlippingBC(i, j, k, nb);
+	}
+	// Left
+	Vector3d nl (-1., 0., 0.);
+	for (int i=4; i<=5; ++i)
+	for (int j=0; j<=ny; ++j)
+	for (int k=0; k<=nz; ++k)
+	{
+		a->SetSlippingBC(i, j, k, nl);
+	}
+	return a;
+}
+
+int main(int argc, char const *argv[])
+{
+	int tt = 500;
+	MPM* a = NewDomain(1);
+	MPM* b = NewDomain(4);
+	for (int t=0; t<tt; ++t)
+	{
+		a->ParticleToNode();
+		a->CalVOnNode();
+		a->NodeToParticle();
+
+		b->ParticleToNode();
+		b->CalVOnNode();
+		b->NodeToParticle();
+	}
+
+	size_t ndiff = 0;
+	double vmax = 0.;
+	for (size_t p=0; p<a->Lp.size(); ++p)
+	{
+		MPM_PARTICLE* p0 = a->Lp[p];
+		MPM_PARTICLE* p1 = b->Lp[p];
+		if (p0->X!=p1->X || p0->V!=p1->V || p0->Stress!=p1->Stress)	ndiff++;
+		vmax = max(vmax, p0->V.norm());
+	}
+	cout << "Particles different between 1 and 4 threads: " << ndiff << " of " << a->Lp.size() << endl;
+	cout << "Max velocity: " << vmax << endl;
+	// the column must have moved, a frozen one would pass trivially
+	if (ndiff>0 || a->Lp.size()!=b->Lp.size() || !(vmax>0.))
+	{
+		cout << "\033[1;31mFAILED\033[0m" << endl;
+		return 1;
+	}
+	cout << "PASSED" << endl;
+	return 0;
+}